@@ -2120,6 +2120,22 @@ struct io_editor_i // NOLINT
                                           io_bool_t skip_serialization);
 };
 
+//----------------------------------------------------------------------------//
+#define IO_EDITOR_SELECTION_API_NAME "io_editor_selection_i"
+//----------------------------------------------------------------------------//
+
+// Provides access to the full selection of the editor. Kept separate from
+// "io_editor_i" so the layout of the latter stays stable.
+//   Note: Not registered by engine versions not providing this functionality
+//   yet. Fall back to "io_editor_i::get_first_selected_entity" in this case.
+//----------------------------------------------------------------------------//
+struct io_editor_selection_i // NOLINT
+{
+  // Returns all selected entities.
+  //   See "Documentation" for usage details.
+  void (*get_selected_entities)(io_ref_t* entities, io_size_t* entities_length);
+};
+
 //----------------------------------------------------------------------------//
 #define IO_CUSTOM_COMPONENTS_API_NAME "io_custom_components_i"
 //----------------------------------------------------------------------------//
@@ -3212,6 +3228,26 @@ struct io_component_voxel_shape_i // NOLINT
   float (*get_mass)(io_ref_t shape);
 };
 
+//----------------------------------------------------------------------------//
+#define IO_COMPONENT_VOXEL_SHAPE_REGION_API_NAME                               \
+  "io_component_voxel_shape_region_i"
+//----------------------------------------------------------------------------//
+
+// Provides region based voxelization for voxel shape components. Kept separate
+// from "io_component_voxel_shape_i" so the layout of the latter stays stable.
+//   Note: Not registered by engine versions not providing this functionality
+//   yet. Fall back to "io_component_voxel_shape_i::voxelize" in this case.
+//----------------------------------------------------------------------------//
+struct io_component_voxel_shape_region_i // NOLINT
+{
+  // Queues the given region (min and max coordinate, inclusive) of the voxel
+  // shape for voxelization. Cheaper than "voxelize" if only a few voxels of a
+  // large shape changed. Has to be called after changing the underlying voxel
+  // data inside the region.
+  void (*voxelize_region)(io_ref_t shape, io_u8vec3_t coord_min,
+                          io_u8vec3_t coord_max);
+};
+
 //----------------------------------------------------------------------------//
 #define IO_COMPONENT_VEHICLE_API_NAME "io_component_vehicle_i"
 //----------------------------------------------------------------------------//
@@ -25,6 +25,11 @@
 #include "gtc/packing.hpp"
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <chrono>
+#include <immintrin.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -55,10 +60,14 @@ const io_logging_i* io_logging = nullptr;
 const io_filesystem_i* io_filesystem = nullptr;
 const io_component_node_i* io_component_node = nullptr;
 const io_component_voxel_shape_i* io_component_voxel_shape = nullptr;
+const io_component_camera_i* io_component_camera = nullptr;
+const io_world_i* io_world = nullptr;
 
 // Interfaces we provide
 //----------------------------------------------------------------------------//
 static io_plugin_terrain_i io_plugin_terrain = {};
+static io_user_task_i io_user_task = {};
+static io_user_editor_i io_user_editor = {};
 
 //----------------------------------------------------------------------------//
 struct chunk_collection_t
@@ -67,74 +76,650 @@ struct chunk_collection_t
 };
 
 //----------------------------------------------------------------------------//
-inline auto get_data_for_chunk_pos(const glm::uvec2 chunk_pos,
-                                   const glm::uvec2 chunk_idx,
-                                   io_uint32_t heightmap_pitch,
-                                   io_uint32_t* const heightmap) -> glm::u8vec4
+// Min/max mip pyramid of the decoded heights of a heightmap (in voxels,
+// including grass). Level zero holds the height of each pixel; each texel of
+// the following levels holds the min/max heights of the (up to) 2x2 texels
+// of the level below. Level log2(CHUNK_SIZE) thus holds the min/max heights of
+// the chunk columns.
+struct heightfield_t
 {
-  const auto pixel_pos =
-      glm::uvec2((CHUNK_SIZE - 1u - chunk_pos.x) + chunk_idx.x * CHUNK_SIZE,
-                 chunk_pos.y + chunk_idx.y * CHUNK_SIZE);
-  const auto pixel_idx = pixel_pos.y * heightmap_pitch + pixel_pos.x;
+  static constexpr uint32_t chunk_level = std::countr_zero(CHUNK_SIZE);
 
-  return glm::unpackUint4x8(heightmap[pixel_idx]);
+  // Decodes the heightmap and builds the pyramid on the scheduler
+  void build(const uint32_t* heightmap, uint32_t size, float max_height)
+  {
+    this->size = size;
+    heights.resize(size * size);
+    levels.clear();
+    for (uint32_t dim = size; dim > 1u;)
+    {
+      dim = (dim + 1u) / 2u;
+      levels.emplace_back(dim * dim);
+    }
+
+    for (uint32_t level = 0u; level <= levels.size(); ++level)
+    {
+      build_task_t task;
+      io_init_scheduler_task(&task, get_dim(level), build_task_t::execute);
+      task.heightfield = this;
+      task.heightmap = heightmap;
+      task.max_height = max_height;
+      task.level = level;
+
+      io_base->scheduler_enqueue_task(&task);
+      io_base->scheduler_wait_for_task(&task);
+    }
+  }
+
+  inline auto get_num_levels() const -> uint32_t
+  {
+    return (uint32_t)levels.size() + 1u;
+  }
+
+  // Returns the number of texels along each axis of the given level
+  inline auto get_dim(uint32_t level) const -> uint32_t
+  {
+    return (size + (1u << level) - 1u) >> level;
+  }
+
+  inline auto get_height(uint32_t x, uint32_t z) const -> uint32_t
+  {
+    return heights[x + z * size];
+  }
+
+  inline auto get_min_max(uint32_t level, uint32_t x, uint32_t z) const
+      -> glm::uvec2
+  {
+    if (level == 0u)
+      return glm::uvec2(get_height(x, z));
+    return glm::uvec2(levels[level - 1u][x + z * get_dim(level)]);
+  }
+
+  // Returns the min/max heights of the pixels in the given (inclusive)
+  // rectangle. Texels fully inside the rectangle are used as is, so only the
+  // texels along its border are refined.
+  auto get_min_max_in_rect(glm::uvec2 min_pixel, glm::uvec2 max_pixel) const
+      -> glm::uvec2
+  {
+    glm::uvec2 result = glm::uvec2(UINT32_MAX, 0u);
+
+    stack.clear();
+    stack.push_back({get_num_levels() - 1u, 0u, 0u});
+    while (!stack.empty())
+    {
+      const texel_t t = stack.back();
+      stack.pop_back();
+
+      const glm::uvec2 texel_min = glm::uvec2(t.x, t.z) << t.level;
+      const glm::uvec2 texel_max =
+          glm::min((glm::uvec2(t.x, t.z) + 1u) << t.level, glm::uvec2(size)) -
+          1u;
+      if (glm::any(glm::greaterThan(texel_min, max_pixel)) ||
+          glm::any(glm::lessThan(texel_max, min_pixel)))
+        continue;
+
+      if (t.level == 0u ||
+          (glm::all(glm::greaterThanEqual(texel_min, min_pixel)) &&
+           glm::all(glm::lessThanEqual(texel_max, max_pixel))))
+      {
+        const glm::uvec2 mm = get_min_max(t.level, t.x, t.z);
+        result = glm::uvec2(glm::min(result.x, mm.x), glm::max(result.y, mm.y));
+        continue;
+      }
+
+      push_children(t);
+    }
+
+    return result;
+  }
+
+  // Intersects the ray with the columns of voxels below the heights. Positions
+  // are given in pixels (x, z) and voxels (y). The texels are traversed front
+  // to back, skipping texels the ray passes above of. Texels the ray enters
+  // below their minimum height are hit right away.
+  auto raycast(glm::vec3 origin, glm::vec3 direction, float max_distance,
+               float& distance) const -> bool
+  {
+    const glm::vec3 inv_direction = 1.0f / direction;
+    float best = max_distance;
+
+    stack.clear();
+    stack.push_back({get_num_levels() - 1u, 0u, 0u});
+    while (!stack.empty())
+    {
+      const texel_t t = stack.back();
+      stack.pop_back();
+
+      const glm::uvec2 mm = get_min_max(t.level, t.x, t.z);
+      if (mm.y == 0u)
+        continue;
+
+      const glm::vec2 texel_min = glm::vec2(glm::uvec2(t.x, t.z) << t.level);
+      const glm::vec2 texel_max = glm::vec2(glm::min(
+          (glm::uvec2(t.x, t.z) + 1u) << t.level, glm::uvec2(size)));
+
+      float t_enter;
+      if (!intersect_box(origin, direction, inv_direction,
+                         glm::vec3(texel_min.x, 0.0f, texel_min.y),
+                         glm::vec3(texel_max.x, mm.y, texel_max.y), best,
+                         t_enter))
+        continue;
+
+      if (t.level == 0u)
+      {
+        best = t_enter;
+        continue;
+      }
+
+      // The part below the minimum height is solid
+      float t_solid;
+      if (mm.x > 0u &&
+          intersect_box(origin, direction, inv_direction,
+                        glm::vec3(texel_min.x, 0.0f, texel_min.y),
+                        glm::vec3(texel_max.x, mm.x, texel_max.y), best,
+                        t_solid))
+        best = t_solid;
+
+      push_children(t, direction);
+    }
+
+    if (best >= max_distance)
+      return false;
+
+    distance = best;
+    return true;
+  }
+
+  uint32_t size{0u};
+
+private:
+  struct texel_t
+  {
+    uint32_t level, x, z;
+  };
+
+  struct build_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      auto task = (build_task_t*)task_;
+      auto& hf = *task->heightfield;
+
+      if (task->level == 0u)
+      {
+        for (uint32_t z = range.x; z < range.y; ++z)
+          decode_row(&task->heightmap[z * hf.size], &hf.heights[z * hf.size],
+                     hf.size, task->max_height);
+        return;
+      }
+
+      const uint32_t dim = hf.get_dim(task->level);
+      const uint32_t child_dim = hf.get_dim(task->level - 1u);
+      glm::u16vec2* level = hf.levels[task->level - 1u].data();
+
+      for (uint32_t z = range.x; z < range.y; ++z)
+      {
+        // Texels at odd borders are used twice
+        const uint32_t z0 = z * 2u;
+        const uint32_t z1 = glm::min(z0 + 1u, child_dim - 1u);
+        glm::u16vec2* texels = &level[z * dim];
+
+        if (task->level == 1u)
+        {
+          const uint16_t* row0 = &hf.heights[z0 * child_dim];
+          const uint16_t* row1 = &hf.heights[z1 * child_dim];
+
+          uint32_t x = reduce_heights(row0, row1, texels, child_dim);
+          for (; x < dim; ++x)
+          {
+            const uint32_t x0 = x * 2u;
+            const uint32_t x1 = glm::min(x0 + 1u, child_dim - 1u);
+            texels[x] = glm::u16vec2(
+                glm::min(glm::min(row0[x0], row0[x1]),
+                         glm::min(row1[x0], row1[x1])),
+                glm::max(glm::max(row0[x0], row0[x1]),
+                         glm::max(row1[x0], row1[x1])));
+          }
+          continue;
+        }
+
+        const glm::u16vec2* row0 = &hf.levels[task->level - 2u][z0 * child_dim];
+        const glm::u16vec2* row1 = &hf.levels[task->level - 2u][z1 * child_dim];
+        for (uint32_t x = 0u; x < dim; ++x)
+        {
+          const uint32_t x0 = x * 2u;
+          const uint32_t x1 = glm::min(x0 + 1u, child_dim - 1u);
+          texels[x] = glm::u16vec2(
+              glm::min(glm::min(row0[x0].x, row0[x1].x),
+                       glm::min(row1[x0].x, row1[x1].x)),
+              glm::max(glm::max(row0[x0].y, row0[x1].y),
+                       glm::max(row1[x0].y, row1[x1].y)));
+        }
+      }
+    }
+
+    // Reduces two rows of heights to min/max texels, eight texels at a time.
+    // Returns the number of texels written.
+    static auto reduce_heights(const uint16_t* row0, const uint16_t* row1,
+                               glm::u16vec2* texels, uint32_t num_heights)
+        -> uint32_t
+    {
+      const __m256i low_mask = _mm256_set1_epi32(0xFFFF);
+
+      uint32_t x = 0u;
+      for (; x * 2u + 16u <= num_heights; x += 8u)
+      {
+        const __m256i h0 = _mm256_loadu_si256((const __m256i*)&row0[x * 2u]);
+        const __m256i h1 = _mm256_loadu_si256((const __m256i*)&row1[x * 2u]);
+        const __m256i min_h = _mm256_min_epu16(h0, h1);
+        const __m256i max_h = _mm256_max_epu16(h0, h1);
+
+        // Reduce the pairs of heights in each 32-bit lane and store them as
+        // (min, max) pairs
+        const __m256i min_pairs = _mm256_min_epu32(
+            _mm256_and_si256(min_h, low_mask), _mm256_srli_epi32(min_h, 16));
+        const __m256i max_pairs = _mm256_max_epu32(
+            _mm256_and_si256(max_h, low_mask), _mm256_srli_epi32(max_h, 16));
+        _mm256_storeu_si256(
+            (__m256i*)&texels[x],
+            _mm256_or_si256(min_pairs, _mm256_slli_epi32(max_pairs, 16)));
+      }
+
+      return x;
+    }
+
+    // Decodes the heights of a row of pixels, eight at a time. Matches
+    // "uint32_t(r / 255.0f * max_height) + g" exactly.
+    static void decode_row(const uint32_t* pixels, uint16_t* heights,
+                           uint32_t num_pixels, float max_height)
+    {
+      const __m256 max_height_v = _mm256_set1_ps(max_height);
+      const __m256 max_value = _mm256_set1_ps(255.0f);
+      const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+
+      for (uint32_t i = 0u; i < num_pixels; i += 8u)
+      {
+        const __m256i p = _mm256_loadu_si256((const __m256i*)&pixels[i]);
+
+        const __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(p, byte_mask));
+        const __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 8), byte_mask);
+        const __m256i h = _mm256_add_epi32(
+            _mm256_cvttps_epi32(
+                _mm256_mul_ps(_mm256_div_ps(r, max_value), max_height_v)),
+            g);
+
+        // Saturate to 16 bits
+        _mm_storeu_si128((__m128i*)&heights[i],
+                         _mm_packus_epi32(_mm256_castsi256_si128(h),
+                                          _mm256_extracti128_si256(h, 1)));
+      }
+    }
+
+    heightfield_t* heightfield;
+    const uint32_t* heightmap;
+    float max_height;
+    uint32_t level;
+  };
+
+  // Pushes the children of the given texel. If a direction is given, the
+  // children are pushed back to front, so the nearest one is popped first.
+  void push_children(const texel_t& t,
+                     const glm::vec3 direction = glm::vec3(0.0f)) const
+  {
+    const uint32_t child_level = t.level - 1u;
+    const uint32_t child_dim = get_dim(child_level);
+    const uint32_t flip_x = direction.x > 0.0f ? 1u : 0u;
+    const uint32_t flip_z = direction.z > 0.0f ? 1u : 0u;
+
+    for (uint32_t i = 0u; i < 4u; ++i)
+    {
+      const uint32_t x = t.x * 2u + ((i & 1u) ^ flip_x);
+      const uint32_t z = t.z * 2u + ((i >> 1u) ^ flip_z);
+      if (x < child_dim && z < child_dim)
+        stack.push_back({child_level, x, z});
+    }
+  }
+
+  // Returns the distance the ray enters the box at (zero if it starts inside)
+  static auto intersect_box(glm::vec3 origin, glm::vec3 direction,
+                            glm::vec3 inv_direction, glm::vec3 box_min,
+                            glm::vec3 box_max, float max_distance,
+                            float& t_enter) -> bool
+  {
+    t_enter = 0.0f;
+    float t_exit = max_distance;
+
+    for (uint32_t i = 0u; i < 3u; ++i)
+    {
+      // Avoid NaNs for rays parallel to the slab
+      if (direction[i] == 0.0f)
+      {
+        if (origin[i] < box_min[i] || origin[i] > box_max[i])
+          return false;
+        continue;
+      }
+
+      float t0 = (box_min[i] - origin[i]) * inv_direction[i];
+      float t1 = (box_max[i] - origin[i]) * inv_direction[i];
+      if (t0 > t1)
+        std::swap(t0, t1);
+
+      t_enter = glm::max(t_enter, t0);
+      t_exit = glm::min(t_exit, t1);
+    }
+
+    return t_enter <= t_exit && t_enter < max_distance;
+  }
+
+  std::vector<uint16_t> heights;
+  std::vector<std::vector<glm::u16vec2>> levels; // Levels one and above
+  mutable std::vector<texel_t> stack;
+};
+
+//----------------------------------------------------------------------------//
+// A generated or streamed terrain and the heightfield of its heightmap
+struct terrain_t
+{
+  io_ref_t node;
+  float voxel_size;
+  heightfield_t heightfield;
+};
+
+// Shared with the terrain stream, which keeps using the heightfield on the
+// scheduler
+static std::vector<std::shared_ptr<terrain_t>> terrains;
+
+//----------------------------------------------------------------------------//
+// Removes the terrains whose node has been destroyed. Called every frame, so
+// the heightfields of destroyed terrains don't stay alive.
+void prune_terrains()
+{
+  std::erase_if(terrains, [](const std::shared_ptr<terrain_t>& t) {
+    return !io_component_node->base.is_alive(t->node);
+  });
 }
 
 //----------------------------------------------------------------------------//
-auto calc_min_max_height_for_chunk(const glm::uvec2 chunk_idx,
-                                   uint32_t heightmap_pitch,
-                                   uint32_t* const heightmap, float max_height,
-                                   uint32_t num_chunks_xz) -> glm::uvec2
+// Returns the terrain of the given node (if any)
+auto find_terrain(io_ref_t node) -> terrain_t*
 {
-  uint32_t max_h = 0u;
-  uint32_t min_h = UINT_MAX;
+  prune_terrains();
 
-  for (uint32_t chunk_pos_z = 0u; chunk_pos_z < CHUNK_SIZE; ++chunk_pos_z)
-    for (uint32_t chunk_pos_x = 0u; chunk_pos_x < CHUNK_SIZE; ++chunk_pos_x)
-    {
-      const auto data =
-          get_data_for_chunk_pos(glm::uvec2(chunk_pos_x, chunk_pos_z),
-                                 chunk_idx, heightmap_pitch, heightmap);
-      auto h = uint32_t((data.x / 255.0f) * max_height);
-      const uint32_t gh = data.g;
-      h += gh;
+  for (auto& t : terrains)
+  {
+    if (io_ref_is_equal(t->node, node))
+      return t.get();
+  }
 
-      max_h = glm::max(max_h, h);
-      min_h = glm::min(min_h, h);
-    }
+  return nullptr;
+}
 
-  return glm::uvec2(min_h, max_h);
+//----------------------------------------------------------------------------//
+auto add_terrain(io_ref_t node, float voxel_size)
+    -> std::shared_ptr<terrain_t>
+{
+  terrains.emplace_back(std::make_shared<terrain_t>());
+  terrains.back()->node = node;
+  terrains.back()->voxel_size = voxel_size;
+  return terrains.back();
 }
 
 //----------------------------------------------------------------------------//
-auto calc_min_max_height_for_adjacent_chunks(const glm::uvec2 chunk_idx,
-                                             uint32_t heightmap_pitch,
-                                             uint32_t* const heightmap,
-                                             float max_height,
-                                             uint32_t num_chunks_xz)
-    -> glm::uvec2
+void remove_terrain(io_ref_t node)
 {
-  const auto ci0 = chunk_idx + glm::uvec2(1u, 0u);
-  const auto ci1 = chunk_idx - glm::uvec2(1u, 0u);
-  const auto ci2 = chunk_idx + glm::uvec2(0u, 1u);
-  const auto ci3 = chunk_idx - glm::uvec2(0u, 1u);
+  std::erase_if(terrains, [node](const std::shared_ptr<terrain_t>& t) {
+    return io_ref_is_equal(t->node, node);
+  });
+}
 
-  const glm::uvec2 cis[] = {ci0, ci1, ci2, ci3};
+//----------------------------------------------------------------------------//
+// Transforms the given world space position to the space of the heightfield
+// (pixels along x/z and voxels along y). The chunks are rotated by 90 degrees
+// around the z-axis, which moves the pixels by one chunk towards negative x.
+// Terrains are expected to be translated only.
+inline auto to_heightfield_space(const terrain_t& terrain, glm::vec3 position)
+    -> glm::vec3
+{
+  const glm::vec3 local =
+      (position -
+       io_cvt(io_component_node->get_world_position(terrain.node))) /
+      terrain.voxel_size;
+  return glm::vec3(local.x + CHUNK_SIZE, local.y, local.z);
+}
 
-  auto min_max = glm::uvec2(UINT_MAX, 0u);
+//----------------------------------------------------------------------------//
+inline auto to_world_height(const terrain_t& terrain, uint32_t height)
+    -> float
+{
+  return io_component_node->get_world_position(terrain.node).y +
+         height * terrain.voxel_size;
+}
 
-  for (auto ci : cis)
+//----------------------------------------------------------------------------//
+// Heights (in voxels, including grass) and palette indices of the voxel
+// columns of a chunk column. The columns are stored in the order of the voxel
+// data of the chunks, so the heightmap is mirrored along x.
+struct chunk_tile_t
+{
+  static_assert(CHUNK_SIZE == 32u, "Columns are written as 256-bit vectors");
+
+  // Decodes the pixels of the given chunk column, eight at a time
+  void decode(const glm::uvec2 chunk_idx, uint32_t heightmap_pitch,
+              const uint32_t* heightmap, float max_height)
+  {
+    const __m256 max_height_v = _mm256_set1_ps(max_height);
+    const __m256 max_value = _mm256_set1_ps(255.0f);
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    for (uint32_t z = 0u; z < CHUNK_SIZE; ++z)
+    {
+      const uint32_t* pixels =
+          &heightmap[(chunk_idx.y * CHUNK_SIZE + z) * heightmap_pitch +
+                     chunk_idx.x * CHUNK_SIZE];
+
+      for (uint32_t x = 0u; x < CHUNK_SIZE; x += 8u)
+      {
+        const __m256i p = _mm256_loadu_si256((const __m256i*)&pixels[x]);
+
+        const __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(p, byte_mask));
+        const __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 8), byte_mask);
+        const __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 16), byte_mask);
+        const __m256i h = _mm256_add_epi32(
+            _mm256_cvttps_epi32(
+                _mm256_mul_ps(_mm256_div_ps(r, max_value), max_height_v)),
+            g);
+        // Palette indices wrap around like the 8-bit voxel values do
+        const __m256i m = _mm256_and_si256(_mm256_add_epi32(b, one), byte_mask);
+
+        // Pixel x is stored in column CHUNK_SIZE - 1 - x
+        const uint32_t column = z * CHUNK_SIZE + CHUNK_SIZE - 8u - x;
+        _mm256_storeu_si256((__m256i*)&heights[column],
+                            _mm256_permutevar8x32_epi32(h, reverse));
+
+        const __m256i m_reversed = _mm256_permutevar8x32_epi32(m, reverse);
+        const __m128i m16 =
+            _mm_packus_epi32(_mm256_castsi256_si128(m_reversed),
+                             _mm256_extracti128_si256(m_reversed, 1));
+        _mm_storel_epi64((__m128i*)&palette_indices[column],
+                         _mm_packus_epi16(m16, m16));
+      }
+    }
+  }
+
+  // Gathers the columns of the given chunk column of LOD n from the
+  // heightfield. Each column covers 2^n x 2^n pixels and is as high as the
+  // highest one of them, using the palette index of the first pixel.
+  void decode_lod(const glm::uvec2 chunk_idx, uint32_t lod,
+                  const heightfield_t& heightfield, uint32_t heightmap_pitch,
+                  const uint32_t* heightmap)
+  {
+    const uint32_t dim = heightfield.get_dim(lod);
+    const uint32_t lod_scale = 1u << lod;
+
+    for (uint32_t z = 0u; z < CHUNK_SIZE; ++z)
+      for (uint32_t x = 0u; x < CHUNK_SIZE; ++x)
+      {
+        const uint32_t column = z * CHUNK_SIZE + x;
+        const auto texel =
+            glm::uvec2((CHUNK_SIZE - 1u - x) + chunk_idx.x * CHUNK_SIZE,
+                       z + chunk_idx.y * CHUNK_SIZE);
+
+        // Columns of LOD chunks can reach beyond the border of the terrain
+        if (texel.x >= dim || texel.y >= dim)
+        {
+          heights[column] = 0u;
+          continue;
+        }
+
+        heights[column] =
+            (heightfield.get_min_max(lod, texel.x, texel.y).y + lod_scale -
+             1u) /
+            lod_scale;
+
+        const auto pixel = texel * lod_scale;
+        palette_indices[column] = (uint8_t)(
+            glm::unpackUint4x8(heightmap[pixel.y * heightmap_pitch + pixel.x])
+                .b +
+            1u);
+      }
+  }
+
+  // Writes the voxels of the given vertical chunk of the column. All voxels
+  // are written in memory order, so recycled chunks don't have to be cleared.
+  void write(uint8_t* voxel_data, uint32_t chunk_y) const
   {
-    if (glm::all(glm::lessThan(ci, glm::uvec2(num_chunks_xz))))
+    const __m256i lanes =
+        _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                         16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+                         29, 30, 31);
+    const uint32_t y0 = chunk_y * CHUNK_SIZE;
+
+    for (uint32_t column = 0u; column < CHUNK_SIZE * CHUNK_SIZE; ++column)
     {
-      const auto mm = calc_min_max_height_for_chunk(
-          ci, heightmap_pitch, heightmap, max_height, num_chunks_xz);
-      min_max.x = glm::min(mm.x, min_max.x);
-      min_max.y = glm::min(mm.y, min_max.y);
+      const uint32_t height = heights[column];
+      const uint32_t num_solid =
+          glm::min(height - glm::min(height, y0), CHUNK_SIZE);
+
+      const __m256i solid =
+          _mm256_cmpgt_epi8(_mm256_set1_epi8((char)num_solid), lanes);
+      _mm256_storeu_si256(
+          (__m256i*)&voxel_data[column * CHUNK_SIZE],
+          _mm256_and_si256(solid,
+                           _mm256_set1_epi8((char)palette_indices[column])));
     }
   }
 
-  return min_max;
+  uint32_t heights[CHUNK_SIZE * CHUNK_SIZE];
+  uint8_t palette_indices[CHUNK_SIZE * CHUNK_SIZE];
+};
+
+//----------------------------------------------------------------------------//
+// Writes the voxels of a single chunk column. Invalid chunks are skipped.
+void fill_chunk_column(const glm::uvec2 chunk_idx, const io_ref_t* chunks,
+                       uint32_t num_chunks, uint32_t heightmap_pitch,
+                       const uint32_t* heightmap, float max_height)
+{
+  chunk_tile_t tile;
+  tile.decode(chunk_idx, heightmap_pitch, heightmap, max_height);
+
+  for (uint32_t y = 0u; y < num_chunks; ++y)
+  {
+    if (io_ref_is_valid(chunks[y]))
+      tile.write(io_component_voxel_shape->get_voxel_data(chunks[y]), y);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Writes the voxels of a single chunk column of the given LOD to the voxel
+// data of its chunks. Null pointers are skipped. Does not call into the API,
+// so it is safe to run while the main thread modifies the world.
+void fill_lod_chunk_column(const glm::uvec2 chunk_idx, uint32_t lod,
+                           uint8_t* const* chunk_data, uint32_t num_chunks,
+                           const heightfield_t& heightfield,
+                           uint32_t heightmap_pitch,
+                           const uint32_t* heightmap)
+{
+  chunk_tile_t tile;
+  tile.decode_lod(chunk_idx, lod, heightfield, heightmap_pitch, heightmap);
+
+  for (uint32_t y = 0u; y < num_chunks; ++y)
+  {
+    if (chunk_data[y])
+      tile.write(chunk_data[y], y);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Returns true if the chunk at the given height of a column has to be created.
+// Chunks of empty columns and chunks enclosed by the ones above are skipped.
+inline auto is_chunk_required(const glm::uvec2 min_max_height, uint32_t y)
+    -> bool
+{
+  constexpr bool skip_enclosed_chunks = true;
+
+  if (min_max_height.y == 0u)
+    return false;
+
+  const uint32_t num_vertical_chunks_min = min_max_height.x / CHUNK_SIZE + 1u;
+  return !(skip_enclosed_chunks && num_vertical_chunks_min >= 2u &&
+           y < num_vertical_chunks_min - 2u);
+}
+
+//----------------------------------------------------------------------------//
+inline auto get_chunk_node(io_ref_t chunk) -> io_ref_t
+{
+  return io_component_node->base.get_component_for_entity(
+      io_component_voxel_shape->base.get_entity(chunk));
+}
+
+//----------------------------------------------------------------------------//
+// Moves the node of a chunk to the given chunk index. Chunks of LOD n use
+// voxels 2^n times the given voxel size and chunk indices in units of their
+// own size.
+void place_chunk(io_ref_t chunk_node, const glm::uvec3 chunk_idx,
+                 float voxel_size, uint32_t lod = 0u)
+{
+  const float lod_voxel_size = voxel_size * (float)(1u << lod);
+
+  // The rotation moves the chunks by their own size towards negative x, so
+  // move LOD chunks back in line with the full resolution ones
+  glm::vec3 position =
+      glm::vec3(chunk_idx) * (float)CHUNK_SIZE * lod_voxel_size;
+  position.x += CHUNK_SIZE * (lod_voxel_size - voxel_size);
+
+  io_component_node->set_position(chunk_node, io_cvt(position));
+  io_component_node->set_orientation(
+      chunk_node,
+      io_cvt(glm::quat(glm::vec3(0.0f, 0.0f, glm::radians(90.0f)))));
+  io_component_node->set_size(chunk_node,
+                              {lod_voxel_size, lod_voxel_size, lod_voxel_size});
+  io_component_node->update_transforms(chunk_node);
+}
+
+//----------------------------------------------------------------------------//
+// Creates the entity for a chunk and returns its voxel shape
+auto create_chunk(io_ref_t terrain_node, const glm::uvec3 chunk_idx,
+                  const char* palette_name, float voxel_size,
+                  uint32_t lod = 0u) -> io_ref_t
+{
+  auto chunk_node = io_component_node->create_with_parent(
+      "terrain_chunk", terrain_node, false);
+  auto chunk_entity = io_component_node->base.get_entity(chunk_node);
+
+  place_chunk(chunk_node, chunk_idx, voxel_size, lod);
+
+  auto shape = io_component_voxel_shape->base.create(chunk_entity);
+  io_component_voxel_shape->base.set_property(
+      shape, "PaletteName", io_variant_from_string(palette_name));
+  io_component_voxel_shape->base.set_property(
+      shape, "CustomSize",
+      io_variant_from_u16vec3({CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE}));
+  io_component_voxel_shape->base.commit_changes(shape);
+
+  return shape;
 }
 
 //----------------------------------------------------------------------------//
@@ -151,64 +736,9 @@ struct terrain_task_t : public io_scheduler_task_t
           glm::uvec2(i % task->num_chunks, i / task->num_chunks);
       const auto& ce = (*task->chunks)[chunk_idx.x][chunk_idx.y];
 
-      for (uint32_t chunk_pos_z = 0u; chunk_pos_z < CHUNK_SIZE; ++chunk_pos_z)
-        for (uint32_t chunk_pos_x = 0u; chunk_pos_x < CHUNK_SIZE; ++chunk_pos_x)
-        {
-          const auto data = get_data_for_chunk_pos(
-              glm::uvec2(chunk_pos_x, chunk_pos_z), chunk_idx,
-              task->heightmap_pitch, task->heightmap);
-          const auto h = uint32_t(data.r / 255.0f * task->max_height);
-          const auto gh = data.g;
-          const auto mat = data.b + 1u;
-
-          // The number of vertical chunks we have to modify
-          const auto num_chunks = (h + gh) / CHUNK_SIZE + 1u;
-
-          uint32_t mat_voxels_to_set = h;
-          uint32_t grass_voxels_to_set = gh;
-
-          for (uint32_t i = 0u; i < num_chunks; ++i)
-          {
-            auto c = ce.chunks[i];
-
-            uint32_t write_start = 0u;
-
-            // Add material
-            if (mat_voxels_to_set > 0u)
-            {
-              const uint32_t voxels_to_set =
-                  glm::min(mat_voxels_to_set, CHUNK_SIZE);
-
-              if (io_ref_is_valid(c))
-              {
-                auto vox_data = io_component_voxel_shape->get_voxel_data(c);
-                memset(&vox_data[chunk_pos_x * CHUNK_SIZE +
-                                 chunk_pos_z * CHUNK_SIZE * CHUNK_SIZE],
-                       mat, voxels_to_set);
-              }
-
-              mat_voxels_to_set -= voxels_to_set;
-              write_start = voxels_to_set;
-            }
-
-            // Add grass
-            if (mat_voxels_to_set == 0u && grass_voxels_to_set > 0u)
-            {
-              const uint32_t voxels_to_set =
-                  glm::min(grass_voxels_to_set, CHUNK_SIZE - write_start);
-
-              if (io_ref_is_valid(c))
-              {
-                auto voxel_data = io_component_voxel_shape->get_voxel_data(c);
-                memset(&voxel_data[chunk_pos_x * CHUNK_SIZE +
-                                   chunk_pos_z * CHUNK_SIZE * CHUNK_SIZE] +
-                           write_start,
-                       mat, voxels_to_set);
-              }
-              grass_voxels_to_set -= voxels_to_set;
-            }
-          }
-        }
+      fill_chunk_column(chunk_idx, ce.chunks.data(),
+                        (uint32_t)ce.chunks.size(), task->heightmap_pitch,
+                        task->heightmap, task->max_height);
     }
   }
 
@@ -238,74 +768,31 @@ auto generate_from_data(const io_plugin_terrain_heightmap_pixel* heightmap,
   auto terrain_node = io_component_node->create("terrain");
   io_component_node->update_transforms(terrain_node);
 
+  // Keep the heightfield around for height queries
+  auto& heightfield = add_terrain(terrain_node, voxel_size)->heightfield;
+  heightfield.build((const uint32_t*)heightmap, size, max_height);
+
   std::vector<std::vector<chunk_collection_t>> chunks;
   chunks.resize(num_chunks_xz);
   for (auto& cs : chunks)
     cs.resize(num_chunks_xz);
 
-  constexpr bool skip_enclosed_chunks = true;
-
+  // Create the chunks on the main thread, skipping empty and enclosed chunks
   for (uint32_t z = 0u; z < num_chunks_xz; ++z)
     for (uint32_t x = 0u; x < num_chunks_xz; ++x)
     {
-      const auto min_max_height = calc_min_max_height_for_chunk(
-          glm::uvec2(x, z), size, (uint32_t*)heightmap, max_height,
-          num_chunks_xz);
-
+      const auto min_max_height =
+          heightfield.get_min_max(heightfield_t::chunk_level, x, z);
       const uint32_t num_vertical_chunks_max =
           min_max_height.y / CHUNK_SIZE + 1u;
-      const uint32_t num_vertical_chunks_min =
-          min_max_height.x / CHUNK_SIZE + 1u;
-
-      std::vector<io_ref_t> vertical_chunks;
-      vertical_chunks.reserve(num_vertical_chunks_max);
 
+      chunks[x][z].chunks.resize(num_vertical_chunks_max, io_ref_invalid());
       for (uint32_t y = 0u; y < num_vertical_chunks_max; ++y)
       {
-        // Skip empty chunks
-        if (min_max_height.y == 0u)
-        {
-          vertical_chunks.emplace_back(io_ref_invalid());
-          continue;
-        }
-
-        // Skip enclosed chunks
-        if (skip_enclosed_chunks && num_vertical_chunks_min >= 2u &&
-            y < num_vertical_chunks_min - 2u)
-        {
-          vertical_chunks.emplace_back(io_ref_invalid());
-          continue;
-        }
-
-        // Set up entity for this chunk
-        {
-          auto chunk_node = io_component_node->create_with_parent(
-              "terrain_chunk", terrain_node, false);
-          auto chunk_entity = io_component_node->base.get_entity(chunk_node);
-
-          io_component_node->set_position(
-              chunk_node,
-              io_cvt(glm::vec3(x, y, z) * (float)CHUNK_SIZE * voxel_size));
-          io_component_node->set_orientation(
-              chunk_node,
-              io_cvt(glm::quat(glm::vec3(0.0f, 0.0f, glm::radians(90.0f)))));
-          io_component_node->set_size(chunk_node,
-                                      {voxel_size, voxel_size, voxel_size});
-          io_component_node->update_transforms(chunk_node);
-
-          auto shape = io_component_voxel_shape->base.create(chunk_entity);
-          io_component_voxel_shape->base.set_property(
-              shape, "PaletteName", io_variant_from_string(palette_name));
-          io_component_voxel_shape->base.set_property(
-              shape, "CustomSize",
-              io_variant_from_u16vec3({CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE}));
-          io_component_voxel_shape->base.commit_changes(shape);
-
-          vertical_chunks.emplace_back(shape);
-        }
+        if (is_chunk_required(min_max_height, y))
+          chunks[x][z].chunks[y] = create_chunk(
+              terrain_node, glm::uvec3(x, y, z), palette_name, voxel_size);
       }
-
-      chunks[x][z] = {std::move(vertical_chunks)};
     }
 
   // Set up and dispatch tasks
@@ -334,9 +821,779 @@ auto generate_from_data(const io_plugin_terrain_heightmap_pixel* heightmap,
 }
 
 //----------------------------------------------------------------------------//
-auto generate_from_image(const char* heightmap_name, const char* palette_name,
-                         io_float32_t max_height, io_float32_t voxel_size)
+// Keeps the chunk columns in rings around the active camera alive. The first
+// ring uses chunks at full resolution; each following ring doubles the radius
+// and uses chunks with twice the voxel size. The columns of all LODs form a
+// quadtree in which columns inside the radius of their LOD are refined, so
+// each area is covered by a single LOD. Missing columns are filled on the
+// scheduler in batches limited by the per frame budget. Columns replaced by
+// another LOD are only released once the new columns are resident, so
+// switching the LOD leaves no holes. The chunks of released columns are hidden
+// and recycled for the next columns instead of being destroyed.
+struct terrain_stream_t
+{
+  enum column_state_
+  {
+    column_state_unloaded,
+    column_state_loading,
+    column_state_resident
+  };
+  using column_state_t = int32_t;
+
+  struct column_t
+  {
+    chunk_collection_t chunks; // Invalid chunks are skipped
+    column_state_t state{column_state_unloaded};
+    glm::uvec2 chunk_idx{0u}; // In chunks of the LOD of the column
+    uint32_t lod{0u};
+    uint32_t resident_idx{UINT32_MAX};
+    uint32_t num_resident_children{0u}; // Including all finer LODs
+    bool is_refined{false}; // Covered by the columns of the next finer LOD
+    bool is_hidden{true};
+    bool is_visible{false}; // Only used for the columns of the coarsest LOD
+  };
+
+  static constexpr uint32_t max_num_lods = 4u;
+  static constexpr io_plugin_terrain_streaming_settings default_settings = {
+      16u, 64u, 8192u, 1u, 0.25f};
+
+  auto start(const uint32_t* heightmap, uint32_t size,
+             const char* palette_name, float max_height, float voxel_size,
+             const io_plugin_terrain_streaming_settings* settings) -> io_ref_t
+  {
+    stop();
+
+    this->heightmap.assign(heightmap, heightmap + size * size);
+    this->size = size;
+    this->palette_name = palette_name;
+    this->voxel_size = voxel_size;
+    num_chunks_xz = size / CHUNK_SIZE;
+    set_settings(settings);
+    init_columns();
+
+    terrain_node = io_component_node->create("terrain");
+    io_component_node->update_transforms(terrain_node);
+
+    // Keep the heightfield alive while the columns are filled
+    terrain = add_terrain(terrain_node, voxel_size);
+    terrain->heightfield.build(heightmap, size, max_height);
+
+    return terrain_node;
+  }
+
+  void set_settings(const io_plugin_terrain_streaming_settings* settings)
+  {
+    io_plugin_terrain_streaming_settings s =
+        settings ? *settings : default_settings;
+    s.max_chunks_per_frame = glm::max(s.max_chunks_per_frame, 1u);
+    s.num_lods = glm::clamp(s.num_lods, 1u, max_num_lods);
+    s.lod_hysteresis = glm::max(s.lod_hysteresis, 0.0f);
+
+    // The quadtree has to be rebuilt if the number of LODs changes
+    const bool rebuild =
+        !columns.empty() && s.num_lods != this->settings.num_lods;
+    if (rebuild)
+    {
+      flush();
+      while (!resident.empty())
+        release_column(resident.back());
+    }
+
+    this->settings = s;
+    if (rebuild)
+      init_columns();
+  }
+
+  // Waits for the columns filled on the scheduler and finishes them
+  void flush()
+  {
+    if (!is_filling)
+      return;
+
+    io_base->scheduler_wait_for_task(&fill_task);
+
+    // The chunks might have been destroyed with the world already
+    if (io_component_node->base.is_alive(terrain_node))
+      finish_batch();
+    else
+      is_filling = false;
+  }
+
+  void stop()
+  {
+    if (is_filling)
+    {
+      io_base->scheduler_wait_for_task(&fill_task);
+      is_filling = false;
+    }
+
+    // The terrain might have been destroyed with the world already
+    if (io_ref_is_valid(terrain_node) &&
+        io_component_node->base.is_alive(terrain_node))
+    {
+      for (const auto& column : columns)
+        for (auto chunk : column.chunks.chunks)
+        {
+          if (io_ref_is_valid(chunk))
+            io_component_node->base.destroy(get_chunk_node(chunk));
+        }
+      for (auto chunk : pool)
+        io_component_node->base.destroy(get_chunk_node(chunk));
+
+      io_component_node->base.destroy(terrain_node);
+    }
+
+    remove_terrain(terrain_node);
+    terrain.reset();
+    terrain_node = io_ref_invalid();
+    heightmap.clear();
+    columns.clear();
+    resident.clear();
+    batch.clear();
+    batch_fills.clear();
+    batch_chunk_data.clear();
+    pool.clear();
+    num_chunks = 0u;
+  }
+
+  // Updates the LODs of the columns and releases and loads columns based on
+  // the position of the active camera. Called once per frame.
+  void update()
+  {
+    if (!io_ref_is_valid(terrain_node))
+      return;
+
+    // The terrain has been destroyed, e.g., with the world. Stopping waits for
+    // the workers before the chunks are dropped.
+    if (!io_component_node->base.is_alive(terrain_node))
+    {
+      stop();
+      return;
+    }
+
+    if (is_filling && io_base->scheduler_is_task_completed(&fill_task))
+      finish_batch();
+
+    const io_ref_t camera = io_world->get_active_camera();
+    if (!io_ref_is_valid(camera))
+      return;
+
+    const io_ref_t camera_node =
+        io_component_node->base.get_component_for_entity(
+            io_component_camera->base.get_entity(camera));
+    // Same mapping as the height queries, so the rings are centered on the
+    // camera despite the rotated chunks
+    const glm::vec3 camera_pos = to_heightfield_space(
+        *terrain, io_cvt(io_component_node->get_world_position(camera_node)));
+    const glm::vec2 center =
+        glm::vec2(camera_pos.x, camera_pos.z) / (float)CHUNK_SIZE;
+
+    release_columns(center);
+    update_columns(center);
+    if (!is_filling)
+      load_columns(center);
+  }
+
+private:
+  struct fill_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      auto task = (fill_task_t*)task_;
+      auto stream = task->stream;
+
+      for (uint32_t i = range.x; i < range.y; ++i)
+      {
+        const auto& fill = stream->batch_fills[i];
+
+        // Recycled chunks are overwritten completely
+        fill_lod_chunk_column(fill.chunk_idx, fill.lod,
+                              &stream->batch_chunk_data[fill.first_chunk],
+                              fill.num_chunks, stream->terrain->heightfield,
+                              stream->size, stream->heightmap.data());
+      }
+    }
+
+    terrain_stream_t* stream;
+  };
+
+  struct candidate_t
+  {
+    float distance;
+    uint32_t column_idx;
+  };
+
+  // Everything the workers need to fill a column of the batch, resolved on
+  // the main thread
+  struct column_fill_t
+  {
+    glm::uvec2 chunk_idx;
+    uint32_t lod;
+    uint32_t first_chunk, num_chunks; // In "batch_chunk_data"
+  };
+
+  // Sets up the unloaded columns of all LODs, finest first
+  void init_columns()
+  {
+    columns.clear();
+    for (uint32_t lod = 0u; lod < settings.num_lods; ++lod)
+    {
+      lod_dims[lod] = (num_chunks_xz + (1u << lod) - 1u) >> lod;
+      lod_offsets[lod] = (uint32_t)columns.size();
+
+      for (uint32_t z = 0u; z < lod_dims[lod]; ++z)
+        for (uint32_t x = 0u; x < lod_dims[lod]; ++x)
+        {
+          auto& column = columns.emplace_back();
+          column.chunk_idx = glm::uvec2(x, z);
+          column.lod = lod;
+        }
+    }
+  }
+
+  inline auto get_column_idx(uint32_t lod, const glm::uvec2 chunk_idx) const
+      -> uint32_t
+  {
+    return lod_offsets[lod] + chunk_idx.x + chunk_idx.y * lod_dims[lod];
+  }
+
+  // Returns the column of the coarsest LOD covering the given column
+  inline auto get_top_column_idx(const column_t& column) const -> uint32_t
+  {
+    const uint32_t top_lod = settings.num_lods - 1u;
+    return get_column_idx(top_lod, column.chunk_idx >> (top_lod - column.lod));
+  }
+
+  // Distance (in full resolution columns) of the given position to the area
+  // covered by the column
+  inline auto calc_distance(const column_t& column,
+                            const glm::vec2 center) const -> float
+  {
+    const glm::vec2 min = glm::vec2(column.chunk_idx << column.lod);
+    const glm::vec2 max = glm::vec2((column.chunk_idx + 1u) << column.lod);
+    return glm::length(
+        glm::max(glm::max(min - center, center - max), glm::vec2(0.0f)));
+  }
+
+  // Returns true if the distance is inside the given radius. Columns which
+  // have been inside before are kept inside within the hysteresis band.
+  inline auto is_inside(float distance, float radius, bool was_inside) const
+      -> bool
+  {
+    return distance <=
+           radius * (was_inside ? 1.0f + settings.lod_hysteresis : 1.0f);
+  }
+
+  // Radius (in full resolution columns) of the ring covered by the given LOD
+  inline auto calc_lod_radius(uint32_t lod) const -> float
+  {
+    return (float)settings.radius * (float)(1u << lod);
+  }
+
+  // Min/max heights of the column (in voxels of its LOD)
+  auto calc_min_max_height(const column_t& column) const -> glm::uvec2
+  {
+    const auto& heightfield = terrain->heightfield;
+    const uint32_t lod_scale = 1u << column.lod;
+
+    // Columns of the coarsest LODs might cover the whole heightfield
+    const uint32_t level = heightfield_t::chunk_level + column.lod;
+    const glm::uvec2 min_max =
+        level < heightfield.get_num_levels()
+            ? heightfield.get_min_max(level, column.chunk_idx.x,
+                                      column.chunk_idx.y)
+            : heightfield.get_min_max(heightfield.get_num_levels() - 1u, 0u,
+                                      0u);
+
+    return glm::uvec2(min_max.x / lod_scale,
+                      (min_max.y + lod_scale - 1u) / lod_scale);
+  }
+
+  void release_columns(const glm::vec2 center)
+  {
+    const float release_radius =
+        calc_lod_radius(settings.num_lods - 1u) *
+        (1.0f + settings.lod_hysteresis);
+
+    // Release the columns of the areas leaving the outermost ring
+    for (uint32_t i = 0u; i < resident.size();)
+    {
+      auto& top_column = columns[get_top_column_idx(columns[resident[i]])];
+      if (calc_distance(top_column, center) > release_radius)
+      {
+        top_column.is_visible = false;
+        release_column(resident[i]);
+      }
+      else
+        ++i;
+    }
+
+    // Release the farthest columns and destroy recycled chunks if the budget
+    // got lowered
+    while (num_chunks - pool.size() > settings.max_resident_chunks)
+    {
+      if (!release_farthest_column(center, -1.0f))
+        break;
+    }
+
+    while (!pool.empty() && num_chunks > settings.max_resident_chunks)
+    {
+      io_component_node->base.destroy(get_chunk_node(pool.back()));
+      pool.pop_back();
+      --num_chunks;
+    }
+  }
+
+  // Updates the LODs of the columns in the outermost ring and gathers the
+  // missing columns, nearest first
+  void update_columns(const glm::vec2 center)
+  {
+    candidates.clear();
+
+    const uint32_t top_lod = settings.num_lods - 1u;
+    const float radius = calc_lod_radius(top_lod);
+    const float release_radius = radius * (1.0f + settings.lod_hysteresis);
+
+    const float top_scale = (float)(1u << top_lod);
+    const glm::ivec2 min_idx = glm::max(
+        glm::ivec2(glm::floor((center - release_radius) / top_scale)),
+        glm::ivec2(0));
+    const glm::ivec2 max_idx =
+        glm::min(glm::ivec2(glm::floor((center + release_radius) / top_scale)),
+                 glm::ivec2((int32_t)lod_dims[top_lod] - 1));
+
+    for (int32_t z = min_idx.y; z <= max_idx.y; ++z)
+      for (int32_t x = min_idx.x; x <= max_idx.x; ++x)
+      {
+        const uint32_t column_idx = get_column_idx(top_lod, glm::uvec2(x, z));
+        auto& column = columns[column_idx];
+        column.is_visible = is_inside(calc_distance(column, center), radius,
+                                      column.is_visible);
+        if (!column.is_visible)
+          continue;
+
+        update_column(column_idx, center);
+        update_visibility(column_idx, false);
+      }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const candidate_t& a, const candidate_t& b) {
+                return a.distance < b.distance;
+              });
+  }
+
+  // Refines the given column if it is inside the ring of the next finer LOD
+  // and gathers the missing columns. Returns true if the area of the column is
+  // covered by resident columns.
+  auto update_column(uint32_t column_idx, const glm::vec2 center) -> bool
+  {
+    auto& column = columns[column_idx];
+    const float distance = calc_distance(column, center);
+
+    if (column.lod > 0u)
+      column.is_refined = is_inside(distance, calc_lod_radius(column.lod - 1u),
+                                    column.is_refined);
+
+    if (!column.is_refined)
+    {
+      if (column.state == column_state_unloaded)
+        candidates.push_back({distance, column_idx});
+      if (column.state != column_state_resident)
+        return false;
+
+      // The finer columns are replaced by this one
+      release_children(column_idx);
+      return true;
+    }
+
+    bool is_covered = true;
+    const uint32_t child_lod = column.lod - 1u;
+    for (uint32_t i = 0u; i < 4u; ++i)
+    {
+      const glm::uvec2 child_idx =
+          column.chunk_idx * 2u + glm::uvec2(i & 1u, i >> 1u);
+      if (glm::all(glm::lessThan(child_idx, glm::uvec2(lod_dims[child_lod]))))
+        is_covered &= update_column(get_column_idx(child_lod, child_idx),
+                                    center);
+    }
+
+    // This column is replaced by the finer ones
+    if (is_covered && column.state == column_state_resident)
+      release_column(column_idx);
+
+    return is_covered;
+  }
+
+  // Shows the resident columns which are not covered by a resident column of
+  // a coarser LOD. Finer columns replacing a coarser one thus stay hidden until
+  // all of them are resident.
+  void update_visibility(uint32_t column_idx, bool is_hidden)
+  {
+    auto& column = columns[column_idx];
+    if (column.state == column_state_resident)
+    {
+      set_column_hidden(column, is_hidden);
+      is_hidden = true;
+    }
+
+    if (column.num_resident_children == 0u)
+      return;
+
+    const uint32_t child_lod = column.lod - 1u;
+    for (uint32_t i = 0u; i < 4u; ++i)
+    {
+      const glm::uvec2 child_idx =
+          column.chunk_idx * 2u + glm::uvec2(i & 1u, i >> 1u);
+      if (glm::all(glm::lessThan(child_idx, glm::uvec2(lod_dims[child_lod]))))
+        update_visibility(get_column_idx(child_lod, child_idx), is_hidden);
+    }
+  }
+
+  void set_column_hidden(column_t& column, bool is_hidden)
+  {
+    if (column.is_hidden == is_hidden)
+      return;
+
+    for (auto chunk : column.chunks.chunks)
+    {
+      if (io_ref_is_valid(chunk))
+        io_component_node->set_hidden(get_chunk_node(chunk), is_hidden);
+    }
+    column.is_hidden = is_hidden;
+  }
+
+  // Releases the resident columns of the finer LODs below the given column
+  void release_children(uint32_t column_idx)
+  {
+    const auto& column = columns[column_idx];
+    if (column.num_resident_children == 0u)
+      return;
+
+    const uint32_t child_lod = column.lod - 1u;
+    for (uint32_t i = 0u; i < 4u; ++i)
+    {
+      const glm::uvec2 child_idx =
+          column.chunk_idx * 2u + glm::uvec2(i & 1u, i >> 1u);
+      if (!glm::all(glm::lessThan(child_idx, glm::uvec2(lod_dims[child_lod]))))
+        continue;
+
+      const uint32_t child_column_idx = get_column_idx(child_lod, child_idx);
+      if (columns[child_column_idx].state == column_state_resident)
+        release_column(child_column_idx);
+      release_children(child_column_idx);
+    }
+  }
+
+  // Updates the number of resident children of the columns above the given one
+  void count_resident_child(const column_t& column, bool is_resident)
+  {
+    glm::uvec2 chunk_idx = column.chunk_idx;
+    for (uint32_t lod = column.lod + 1u; lod < settings.num_lods; ++lod)
+    {
+      chunk_idx /= 2u;
+      auto& parent = columns[get_column_idx(lod, chunk_idx)];
+      if (is_resident)
+        ++parent.num_resident_children;
+      else
+        --parent.num_resident_children;
+    }
+  }
+
+  // Hides the chunks of the given resident column and moves them to the pool
+  void release_column(uint32_t column_idx)
+  {
+    auto& column = columns[column_idx];
+    for (auto chunk : column.chunks.chunks)
+    {
+      if (!io_ref_is_valid(chunk))
+        continue;
+
+      io_component_node->set_hidden(get_chunk_node(chunk), true);
+      pool.push_back(chunk);
+    }
+
+    column.chunks.chunks.clear();
+    column.state = column_state_unloaded;
+    column.is_hidden = true;
+    count_resident_child(column, false);
+
+    const uint32_t last_column_idx = resident.back();
+    resident[column.resident_idx] = last_column_idx;
+    columns[last_column_idx].resident_idx = column.resident_idx;
+    resident.pop_back();
+    column.resident_idx = UINT32_MAX;
+  }
+
+  // Releases the resident column farthest from the given position if it is
+  // farther away than the given distance
+  auto release_farthest_column(const glm::vec2 center, float min_distance)
+      -> bool
+  {
+    uint32_t farthest = UINT32_MAX;
+    float max_distance = min_distance;
+    for (uint32_t column_idx : resident)
+    {
+      const float distance = calc_distance(columns[column_idx], center);
+      if (distance > max_distance)
+      {
+        max_distance = distance;
+        farthest = column_idx;
+      }
+    }
+
+    if (farthest == UINT32_MAX)
+      return false;
+
+    release_column(farthest);
+    return true;
+  }
+
+  inline auto calc_num_available_chunks() const -> uint32_t
+  {
+    return (uint32_t)pool.size() +
+           (settings.max_resident_chunks -
+            glm::min(num_chunks, settings.max_resident_chunks));
+  }
+
+  void load_columns(const glm::vec2 center)
+  {
+    uint32_t budget = settings.max_chunks_per_frame;
+    for (const auto& candidate : candidates)
+    {
+      auto& column = columns[candidate.column_idx];
+      const auto min_max_height = calc_min_max_height(column);
+      const uint32_t num_vertical_chunks = min_max_height.y / CHUNK_SIZE + 1u;
+
+      uint32_t num_required_chunks = 0u;
+      for (uint32_t y = 0u; y < num_vertical_chunks; ++y)
+        num_required_chunks += is_chunk_required(min_max_height, y);
+
+      // Always load at least one column per batch, even if it exceeds the
+      // budget per frame
+      if (num_required_chunks > budget && !batch.empty())
+        break;
+
+      // Make room for nearer columns if the resident budget is exhausted
+      while (num_required_chunks > calc_num_available_chunks())
+      {
+        if (!release_farthest_column(center, candidate.distance))
+          break;
+      }
+      if (num_required_chunks > calc_num_available_chunks())
+        break;
+
+      auto& chunks = column.chunks.chunks;
+      chunks.resize(num_vertical_chunks, io_ref_invalid());
+      for (uint32_t y = 0u; y < num_vertical_chunks; ++y)
+      {
+        if (is_chunk_required(min_max_height, y))
+          chunks[y] = acquire_chunk(
+              glm::uvec3(column.chunk_idx.x, y, column.chunk_idx.y),
+              column.lod);
+      }
+
+      // The chunks of the batch are only destroyed after "finish_batch"
+      batch_fills.push_back({column.chunk_idx, column.lod,
+                             (uint32_t)batch_chunk_data.size(),
+                             num_vertical_chunks});
+      for (auto chunk : chunks)
+        batch_chunk_data.push_back(
+            io_ref_is_valid(chunk)
+                ? io_component_voxel_shape->get_voxel_data(chunk)
+                : nullptr);
+
+      column.state = column_state_loading;
+      batch.push_back(candidate.column_idx);
+
+      budget -= glm::min(budget, num_required_chunks);
+      if (budget == 0u)
+        break;
+    }
+
+    if (batch.empty())
+      return;
+
+    io_init_scheduler_task(&fill_task, (uint32_t)batch.size(),
+                           fill_task_t::execute);
+    fill_task.stream = this;
+
+    io_base->scheduler_enqueue_task(&fill_task);
+    is_filling = true;
+  }
+
+  // Voxelizes the chunks of the filled columns. The columns are shown by the
+  // next visibility update.
+  void finish_batch()
+  {
+    for (uint32_t column_idx : batch)
+    {
+      auto& column = columns[column_idx];
+      for (auto chunk : column.chunks.chunks)
+      {
+        if (io_ref_is_valid(chunk))
+          io_component_voxel_shape->voxelize(chunk);
+      }
+
+      column.state = column_state_resident;
+      column.resident_idx = (uint32_t)resident.size();
+      resident.push_back(column_idx);
+      count_resident_child(column, true);
+    }
+
+    batch.clear();
+    batch_fills.clear();
+    batch_chunk_data.clear();
+    is_filling = false;
+  }
+
+  // Recycles a chunk of the pool or creates a new one. Chunks stay hidden
+  // until they have been filled.
+  auto acquire_chunk(const glm::uvec3 chunk_idx, uint32_t lod) -> io_ref_t
+  {
+    io_ref_t chunk;
+    if (!pool.empty())
+    {
+      chunk = pool.back();
+      pool.pop_back();
+
+      place_chunk(get_chunk_node(chunk), chunk_idx, voxel_size, lod);
+    }
+    else
+    {
+      chunk = create_chunk(terrain_node, chunk_idx, palette_name.c_str(),
+                           voxel_size, lod);
+      ++num_chunks;
+    }
+
+    io_component_node->set_hidden(get_chunk_node(chunk), true);
+    return chunk;
+  }
+
+  io_ref_t terrain_node{io_ref_invalid()};
+  std::shared_ptr<terrain_t> terrain;
+  io_plugin_terrain_streaming_settings settings{default_settings};
+
+  std::vector<uint32_t> heightmap;
+  uint32_t size{0u};
+  std::string palette_name;
+  float voxel_size{0.0f};
+
+  // Columns of all LODs, finest first
+  uint32_t num_chunks_xz{0u};
+  std::vector<column_t> columns;
+  uint32_t lod_offsets[max_num_lods]{};
+  uint32_t lod_dims[max_num_lods]{};
+  std::vector<uint32_t> resident; // Columns with filled chunks
+  std::vector<candidate_t> candidates;
+
+  // Columns currently filled on the scheduler
+  fill_task_t fill_task;
+  std::vector<uint32_t> batch;
+  std::vector<column_fill_t> batch_fills;
+  std::vector<uint8_t*> batch_chunk_data;
+  bool is_filling{false};
+
+  std::vector<io_ref_t> pool; // Hidden chunks ready to be recycled
+  uint32_t num_chunks{0u};    // Number of chunks alive (including the pool)
+} terrain_stream;
+
+//----------------------------------------------------------------------------//
+auto stream_from_data(const io_plugin_terrain_heightmap_pixel* heightmap,
+                      const io_uint32_t size, const char* palette_name,
+                      io_float32_t max_height, io_float32_t voxel_size,
+                      const io_plugin_terrain_streaming_settings* settings)
     -> io_ref_t
+{
+  if (size % CHUNK_SIZE != 0u)
+  {
+    io_logging->log_warning(
+        "Terrain size needs to be a multiple of the chunk size of 32 voxels.");
+    return io_ref_invalid();
+  }
+
+  return terrain_stream.start((const uint32_t*)heightmap, size, palette_name,
+                              max_height, voxel_size, settings);
+}
+
+//----------------------------------------------------------------------------//
+void set_streaming_settings(
+    const io_plugin_terrain_streaming_settings* settings)
+{
+  terrain_stream.set_settings(settings);
+}
+
+//----------------------------------------------------------------------------//
+void stop_streaming() { terrain_stream.stop(); }
+
+//----------------------------------------------------------------------------//
+auto get_height_at(io_ref_t terrain_node, io_float32_t x, io_float32_t z,
+                   io_float32_t* height) -> io_bool_t
+{
+  const terrain_t* terrain = find_terrain(terrain_node);
+  if (!terrain)
+    return false;
+
+  const auto& heightfield = terrain->heightfield;
+  const glm::vec3 p = to_heightfield_space(*terrain, glm::vec3(x, 0.0f, z));
+  if (p.x < 0.0f || p.z < 0.0f || p.x >= heightfield.size ||
+      p.z >= heightfield.size)
+    return false;
+
+  *height = to_world_height(
+      *terrain, heightfield.get_height((uint32_t)p.x, (uint32_t)p.z));
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+auto get_min_max_in_rect(io_ref_t terrain_node, io_vec2_t min, io_vec2_t max,
+                         io_vec2_t* min_max) -> io_bool_t
+{
+  const terrain_t* terrain = find_terrain(terrain_node);
+  if (!terrain)
+    return false;
+
+  const auto& heightfield = terrain->heightfield;
+  const glm::vec3 p0 =
+      to_heightfield_space(*terrain, glm::vec3(min.x, 0.0f, min.y));
+  const glm::vec3 p1 =
+      to_heightfield_space(*terrain, glm::vec3(max.x, 0.0f, max.y));
+
+  const glm::vec2 rect_min = glm::floor(glm::min(glm::vec2(p0.x, p0.z),
+                                                 glm::vec2(p1.x, p1.z)));
+  const glm::vec2 rect_max = glm::floor(glm::max(glm::vec2(p0.x, p0.z),
+                                                 glm::vec2(p1.x, p1.z)));
+  if (rect_max.x < 0.0f || rect_max.y < 0.0f ||
+      rect_min.x >= heightfield.size || rect_min.y >= heightfield.size)
+    return false;
+
+  const glm::uvec2 pixel_min = glm::uvec2(glm::max(rect_min, glm::vec2(0.0f)));
+  const glm::uvec2 pixel_max = glm::uvec2(
+      glm::min(rect_max, glm::vec2(heightfield.size - 1u)));
+
+  const glm::uvec2 mm = heightfield.get_min_max_in_rect(pixel_min, pixel_max);
+  *min_max = {to_world_height(*terrain, mm.x), to_world_height(*terrain, mm.y)};
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+auto raycast(io_ref_t terrain_node, io_vec3_t origin, io_vec3_t direction,
+             io_float32_t max_distance, io_float32_t* distance) -> io_bool_t
+{
+  const terrain_t* terrain = find_terrain(terrain_node);
+  if (!terrain)
+    return false;
+
+  // Distances along the ray are the same in both spaces
+  return terrain->heightfield.raycast(
+      to_heightfield_space(*terrain, io_cvt(origin)),
+      io_cvt(direction) / terrain->voxel_size, max_distance, *distance);
+}
+
+//----------------------------------------------------------------------------//
+// Loads a square heightmap image. The returned data has to be freed.
+auto load_heightmap_image(const char* heightmap_name, int32_t& size)
+    -> uint32_t*
 {
   const std::string filepath =
       std::string("/media/heightmaps/") + heightmap_name;
@@ -348,7 +1605,7 @@ auto generate_from_image(const char* heightmap_name, const char* palette_name,
   if (!io_filesystem->load_file_from_data_source(filepath.c_str(), data.data(),
                                                  &length))
   {
-    return io_ref_invalid();
+    return nullptr;
   }
 
   int32_t width, height;
@@ -362,11 +1619,25 @@ auto generate_from_image(const char* heightmap_name, const char* palette_name,
 
     // Clean up
     free(heightmap);
-    return io_ref_invalid();
+    return nullptr;
   }
 
+  size = width;
+  return heightmap;
+}
+
+//----------------------------------------------------------------------------//
+auto generate_from_image(const char* heightmap_name, const char* palette_name,
+                         io_float32_t max_height, io_float32_t voxel_size)
+    -> io_ref_t
+{
+  int32_t size;
+  auto* heightmap = load_heightmap_image(heightmap_name, size);
+  if (!heightmap)
+    return io_ref_invalid();
+
   io_ref_t result =
-      generate_from_data((io_plugin_terrain_heightmap_pixel*)heightmap, width,
+      generate_from_data((io_plugin_terrain_heightmap_pixel*)heightmap, size,
                          palette_name, max_height, voxel_size);
 
   // Clean up
@@ -375,6 +1646,111 @@ auto generate_from_image(const char* heightmap_name, const char* palette_name,
   return result;
 }
 
+//----------------------------------------------------------------------------//
+auto stream_from_image(const char* heightmap_name, const char* palette_name,
+                       io_float32_t max_height, io_float32_t voxel_size,
+                       const io_plugin_terrain_streaming_settings* settings)
+    -> io_ref_t
+{
+  int32_t size;
+  auto* heightmap = load_heightmap_image(heightmap_name, size);
+  if (!heightmap)
+    return io_ref_invalid();
+
+  io_ref_t result =
+      stream_from_data((io_plugin_terrain_heightmap_pixel*)heightmap, size,
+                       palette_name, max_height, voxel_size, settings);
+
+  // Clean up
+  free(heightmap);
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+namespace benchmark
+{
+
+//----------------------------------------------------------------------------//
+// Measures the throughput of the generation kernel (decoding and writing the
+// voxels of all chunks up to the maximum height) for a synthetic 4096^2
+// heightmap on a single thread. All chunks share the same voxel data, so
+// entity creation and voxelization are excluded.
+void generate()
+{
+  constexpr uint32_t size = 4096u;
+  constexpr float max_height = 255.0f;
+  constexpr uint32_t num_samples = 5u;
+
+  std::vector<uint32_t> heightmap(size * size);
+  for (uint32_t z = 0u; z < size; ++z)
+    for (uint32_t x = 0u; x < size; ++x)
+    {
+      const float h = 0.5f + 0.45f * glm::sin(x * 0.01f) * glm::cos(z * 0.013f);
+      heightmap[x + z * size] =
+          io_plugin_terrain_create_heightmap_pixel(h, (x + z) % 4u / 255.0f,
+                                                   (x / 64u + z / 64u) % 16u)
+              .internal;
+    }
+
+  const uint32_t num_chunks_xz = size / CHUNK_SIZE;
+  const uint32_t num_chunks = (uint32_t)max_height / CHUNK_SIZE + 2u;
+  std::vector<uint8_t> voxel_data(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE);
+  chunk_tile_t tile;
+
+  double accumulated_ms = 0.0;
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t z = 0u; z < num_chunks_xz; ++z)
+      for (uint32_t x = 0u; x < num_chunks_xz; ++x)
+      {
+        tile.decode(glm::uvec2(x, z), size, heightmap.data(), max_height);
+        for (uint32_t y = 0u; y < num_chunks; ++y)
+          tile.write(voxel_data.data(), y);
+      }
+    const auto end = std::chrono::high_resolution_clock::now();
+
+    accumulated_ms +=
+        std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  const double ms = accumulated_ms / num_samples;
+  const double num_voxels = (double)num_chunks_xz * num_chunks_xz *
+                            num_chunks * CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+
+  char msg[256];
+  snprintf(msg, sizeof(msg),
+           "Terrain generation (Num. Samples: %u): ~%.3f ms, ~%.2f GVoxels/s",
+           num_samples, ms, num_voxels / (ms * 1e-3) * 1e-9);
+  io_logging->log_info(msg);
+}
+
+} // namespace benchmark
+
+//----------------------------------------------------------------------------//
+static void on_tick(io_float32_t delta_t)
+{
+  prune_terrains();
+  terrain_stream.update();
+}
+
+//----------------------------------------------------------------------------//
+// The world might be torn down or restored after this, so no column may still
+// be filled by the workers. The stream itself is kept, so a terrain streamed
+// in the editor survives entering game mode. It is stopped by the next update
+// if its node has been destroyed with the world.
+static void on_deactivate() { terrain_stream.flush(); }
+
+//----------------------------------------------------------------------------//
+static void on_activate() {}
+
+//----------------------------------------------------------------------------//
+static void on_tick_physics(io_float32_t delta_t) {}
+
+//----------------------------------------------------------------------------//
+static void on_build_plugin_menu() {}
+
 //----------------------------------------------------------------------------//
 IO_API_EXPORT io_uint32_t IO_API_CALL get_api_version()
 {
@@ -398,22 +1774,61 @@ IO_API_EXPORT int IO_API_CALL load_plugin(void* api_manager)
     io_component_voxel_shape =
         (const io_component_voxel_shape_i*)io_api_manager->find_first(
             IO_COMPONENT_VOXEL_SHAPE_API_NAME);
+    io_component_camera =
+        (const io_component_camera_i*)io_api_manager->find_first(
+            IO_COMPONENT_CAMERA_API_NAME);
+    io_world = (const io_world_i*)io_api_manager->find_first(IO_WORLD_API_NAME);
   }
 
   // Register the interfaces we provide
   {
     io_plugin_terrain.generate_from_data = generate_from_data;
     io_plugin_terrain.generate_from_image = generate_from_image;
+    io_plugin_terrain.stream_from_data = stream_from_data;
+    io_plugin_terrain.stream_from_image = stream_from_image;
+    io_plugin_terrain.set_streaming_settings = set_streaming_settings;
+    io_plugin_terrain.stop_streaming = stop_streaming;
+    io_plugin_terrain.get_height_at = get_height_at;
+    io_plugin_terrain.get_min_max_in_rect = get_min_max_in_rect;
+    io_plugin_terrain.raycast = raycast;
 
     io_api_manager->register_api(IO_PLUGIN_TERRAIN_API_NAME,
                                  &io_plugin_terrain);
   }
 
+  // Stream terrain in game mode and in the editor
+  {
+    io_user_task = {};
+    {
+      io_user_task.on_activate = on_activate;
+      io_user_task.on_deactivate = on_deactivate;
+      io_user_task.on_tick = on_tick;
+      io_user_task.on_tick_physics = on_tick_physics;
+    }
+    io_api_manager->register_api(IO_USER_TASK_API_NAME, &io_user_task);
+
+    io_user_editor = {};
+    {
+      io_user_editor.on_build_plugin_menu = on_build_plugin_menu;
+      io_user_editor.on_activate = on_activate;
+      io_user_editor.on_deactivate = on_deactivate;
+      io_user_editor.on_tick = on_tick;
+    }
+    io_api_manager->register_api(IO_USER_EDITOR_API_NAME, &io_user_editor);
+  }
+
+  // benchmark::generate();
+
   return 0;
 }
 
 //----------------------------------------------------------------------------//
 IO_API_EXPORT void IO_API_CALL unload_plugin()
 {
+  terrain_stream.stop();
+  terrains.clear();
+
+  io_api_manager->unregister_api(&io_user_editor);
+  io_api_manager->unregister_api(&io_user_task);
   io_api_manager->unregister_api(&io_plugin_terrain);
 }
@@ -48,6 +48,25 @@ io_plugin_terrain_create_heightmap_pixel(io_float32_t height,
   return p;
 }
 
+// Settings for streaming terrain
+//----------------------------------------------------------------------------//
+typedef struct
+{
+  // Radius (in chunk columns) of the ring of full resolution columns kept
+  // around the camera.
+  io_uint32_t radius;
+  // Maximum number of chunks filled per frame.
+  io_uint32_t max_chunks_per_frame;
+  // Maximum number of chunks alive at once (including recycled chunks).
+  io_uint32_t max_resident_chunks;
+  // Number of LOD rings (1-4). Each additional ring doubles the radius and
+  // covers its area with chunks of twice the voxel size.
+  io_uint32_t num_lods;
+  // Relative width of the band around each ring in which the current LOD is
+  // kept, so cameras moving along a ring do not thrash.
+  io_float32_t lod_hysteresis;
+} io_plugin_terrain_streaming_settings;
+
 //----------------------------------------------------------------------------//
 #define IO_PLUGIN_TERRAIN_API_NAME "io_plugin_terrain_i"
 //----------------------------------------------------------------------------//
@@ -66,6 +85,43 @@ struct io_plugin_terrain_i
                                   const char* palette_name,
                                   io_float32_t max_height,
                                   io_float32_t voxel_size);
+
+  // Streams heightmap based terrain from the provided data. Only the chunks
+  // in a ring around the active camera are kept alive. The data is copied and
+  // replaces the currently streamed terrain (if any).
+  io_ref_t (*stream_from_data)(
+      const io_plugin_terrain_heightmap_pixel* heightmap, io_uint32_t size,
+      const char* palette_name, io_float32_t max_height,
+      io_float32_t voxel_size,
+      const io_plugin_terrain_streaming_settings* settings);
+  // Streams heightmap based terrain from the provided image.
+  io_ref_t (*stream_from_image)(
+      const char* heightmap_filename, const char* palette_name,
+      io_float32_t max_height, io_float32_t voxel_size,
+      const io_plugin_terrain_streaming_settings* settings);
+  // Updates the settings of the currently streamed terrain.
+  void (*set_streaming_settings)(
+      const io_plugin_terrain_streaming_settings* settings);
+  // Stops streaming and destroys the currently streamed terrain.
+  void (*stop_streaming)();
+
+  // Height queries for generated and streamed terrain. All positions and
+  // heights are given in world space.
+
+  // Gets the height of the terrain at the given position. Returns false if the
+  // position is outside of the terrain.
+  io_bool_t (*get_height_at)(io_ref_t terrain, io_float32_t x, io_float32_t z,
+                             io_float32_t* height);
+  // Gets the minimum and maximum height of the terrain in the given rectangle
+  // (on the xz-plane). Returns false if the rectangle is outside of the
+  // terrain.
+  io_bool_t (*get_min_max_in_rect)(io_ref_t terrain, io_vec2_t min,
+                                   io_vec2_t max, io_vec2_t* min_max);
+  // Raycasts the terrain. Returns true on hit and the distance along the
+  // direction to the hit.
+  io_bool_t (*raycast)(io_ref_t terrain, io_vec3_t origin,
+                       io_vec3_t direction, io_float32_t max_distance,
+                       io_float32_t* distance);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,327 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "sparse_volume.h"
+
+//----------------------------------------------------------------------------//
+// Footprint of a box or sphere brush stored as spans along x. The spans are
+// only rebuilt if the shape or the extent of the brush changes.
+struct brush_stamp_t
+{
+  struct span_t
+  {
+    int16_t y, z;
+    int16_t x0, x1; // [x0, x1)
+  };
+
+  // Rebuilds the spans if the given parameters differ from the current ones.
+  // Spheres are scaled via "radius" (in voxels), independent of the extent.
+  void build(bool sphere, glm::ivec3 extent, float radius)
+  {
+    if (is_sphere == sphere && this->extent == extent &&
+        this->radius == radius)
+      return;
+
+    is_sphere = sphere;
+    this->extent = extent;
+    this->radius = radius;
+    spans.clear();
+
+    const glm::vec3 half_extent = glm::vec3(extent) * 0.5f;
+    for (int32_t z = 0; z < extent.z; ++z)
+      for (int32_t y = 0; y < extent.y; ++y)
+      {
+        if (!sphere)
+        {
+          spans.push_back({(int16_t)y, (int16_t)z, 0, (int16_t)extent.x});
+          continue;
+        }
+
+        // Voxels inside the sphere form a single span per row. Solve for the
+        // span analytically and fix up its ends using the exact test.
+        const auto inside = [&](int32_t x) -> bool {
+          const glm::vec3 coord =
+              (glm::vec3(x, y, z) - half_extent + 0.5f) / radius;
+          return glm::length(coord) < 1.0f;
+        };
+
+        const float cy = (y - half_extent.y + 0.5f) / radius;
+        const float cz = (z - half_extent.z + 0.5f) / radius;
+        const float q = 1.0f - cy * cy - cz * cz;
+        if (q < -1e-3f)
+          continue;
+
+        const float center = half_extent.x - 0.5f;
+        const float half_width = glm::sqrt(glm::max(q, 0.0f)) * radius;
+        int32_t x0 = glm::max((int32_t)glm::floor(center - half_width), 0);
+        int32_t x1 = glm::min((int32_t)glm::ceil(center + half_width) + 1,
+                              extent.x);
+
+        while (x0 < x1 && !inside(x0))
+          ++x0;
+        while (x1 > x0 && !inside(x1 - 1))
+          --x1;
+
+        if (x0 < x1)
+          spans.push_back({(int16_t)y, (int16_t)z, (int16_t)x0, (int16_t)x1});
+      }
+  }
+
+  std::vector<span_t> spans;
+  glm::ivec3 extent{0};
+  float radius{0.0f};
+  bool is_sphere{false};
+};
+
+//----------------------------------------------------------------------------//
+struct brush_settings_t
+{
+  float density{1.0f};
+  uint32_t seed{0u};
+  const palette_range_t* palette_range{nullptr}; // Erases if null
+  remove_mode_t remove_mode{remove_mode_solid};  // Voxels of the shape to skip
+  uint8_t mirror_axis_mask{0u};
+
+  // Hash of all settings affecting the result of a stamp
+  inline auto calc_hash() const -> uint32_t
+  {
+    uint32_t h = common::hash(seed ^ (uint32_t)remove_mode << 8u ^
+                              (uint32_t)mirror_axis_mask);
+    h = common::hash(h ^ std::bit_cast<uint32_t>(density));
+    if (palette_range)
+      h ^= common::hash((const char*)palette_range->palette_indices.data(),
+                        (uint32_t)palette_range->palette_indices.size());
+    return h;
+  }
+};
+
+//----------------------------------------------------------------------------//
+// Accumulates the stamps of a brush stroke into a sparse volume. Each stamp is
+// rasterized into brick masks and ORed into the occupancy of the stroke, so
+// voxels covered by previous stamps are skipped right away. Whether a voxel is
+// placed and its palette index are derived from a hash of its coordinate, so
+// overlapping stamps always agree.
+struct brush_stroke_t
+{
+  // Stamps the brush at the given offset (the minimum corner of the
+  // footprint). Consecutive stamps of the same brush are connected via
+  // intermediate stamps, so fast mouse motion leaves no gaps.
+  void stamp_to(io_ref_t shape, const brush_stamp_t& brush, glm::ivec3 offset,
+                const brush_settings_t& settings)
+  {
+    const bool connect = has_last_stamp &&
+                         io_ref_is_equal(last_shape, shape) &&
+                         last_extent == brush.extent &&
+                         last_is_sphere == brush.is_sphere;
+
+    if (connect && last_offset == offset)
+      return;
+
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    const auto dim =
+        glm::ivec3(io_cvt(io_component_voxel_shape->get_dim(shape)));
+
+    uint32_t num_steps = 1u;
+    if (connect)
+    {
+      // Space the stamps by a quarter of the smallest extent, so even single
+      // voxel brushes leave no gaps
+      const int32_t min_extent = glm::min(
+          brush.extent.x, glm::min(brush.extent.y, brush.extent.z));
+      const int32_t spacing = glm::max(1, min_extent / 4);
+
+      const glm::ivec3 delta = glm::abs(offset - last_offset);
+      const int32_t max_delta = glm::max(delta.x, glm::max(delta.y, delta.z));
+      num_steps = (uint32_t)((max_delta + spacing - 1) / spacing);
+    }
+
+    for (uint32_t i = 1u; i <= num_steps; ++i)
+    {
+      glm::ivec3 o = offset;
+      if (connect)
+      {
+        const float t = i / (float)num_steps;
+        o = glm::ivec3(glm::round(glm::vec3(last_offset) +
+                                  glm::vec3(offset - last_offset) * t));
+      }
+
+      // Boxes and spheres are symmetric, so mirroring the stamp only moves it
+      for (uint32_t combination = 0u; combination < 8u; ++combination)
+      {
+        if ((combination & settings.mirror_axis_mask) != combination)
+          continue;
+
+        glm::ivec3 mirrored = o;
+        for (uint32_t a = 0u; a < 3u; ++a)
+        {
+          if (combination & (1u << a))
+            mirrored[a] = dim[a] - o[a] - brush.extent[a];
+        }
+
+        blit(data, dim, brush, mirrored, settings, combination);
+      }
+    }
+
+    has_last_stamp = true;
+    last_shape = shape;
+    last_offset = offset;
+    last_extent = brush.extent;
+    last_is_sphere = brush.is_sphere;
+    last_settings_hash = settings.calc_hash();
+  }
+
+  // Returns true if the last stamp used the given shape, brush, offset and
+  // settings
+  inline auto is_last_stamp(io_ref_t shape, const brush_stamp_t& brush,
+                            glm::ivec3 offset,
+                            const brush_settings_t& settings) const -> bool
+  {
+    return has_last_stamp && io_ref_is_equal(last_shape, shape) &&
+           last_offset == offset &&
+           last_extent == brush.extent && last_is_sphere == brush.is_sphere &&
+           last_settings_hash == settings.calc_hash();
+  }
+
+  // Ends the current run of connected stamps, e.g., when the ray misses
+  inline void lift() { has_last_stamp = false; }
+
+  void clear()
+  {
+    volume.clear();
+    visited.clear();
+    has_last_stamp = false;
+  }
+
+  sparse_volume_t volume;
+
+private:
+  // Blits a single (mirrored) copy of the brush. The dither and palette hash
+  // uses the unmirrored coordinate, so mirrored copies show a mirror image of
+  // the same pattern.
+  void blit(const uint8_t* data, glm::ivec3 dim, const brush_stamp_t& brush,
+            glm::ivec3 offset, const brush_settings_t& settings,
+            uint32_t mirror_axis_mask)
+  {
+    const glm::ivec3 min_coord = glm::max(offset, glm::ivec3(0));
+    const glm::ivec3 max_coord = glm::min(offset + brush.extent, dim) - 1;
+    if (max_coord.x < min_coord.x || max_coord.y < min_coord.y ||
+        max_coord.z < min_coord.z)
+      return;
+
+    // Rasterize the spans to brick masks covering the clipped footprint
+    const glm::ivec3 brick_min = min_coord >> 2;
+    const glm::ivec3 brick_dim = (max_coord >> 2) - brick_min + 1;
+    masks.assign((size_t)brick_dim.x * brick_dim.y * brick_dim.z, 0u);
+
+    for (const auto& s : brush.spans)
+    {
+      const int32_t y = offset.y + s.y, z = offset.z + s.z;
+      if (y < min_coord.y || y > max_coord.y || z < min_coord.z ||
+          z > max_coord.z)
+        continue;
+
+      const int32_t x0 = glm::max(offset.x + s.x0, min_coord.x);
+      const int32_t x1 = glm::min(offset.x + s.x1, max_coord.x + 1);
+      if (x0 >= x1)
+        continue;
+
+      const uint32_t row_shift = ((y & 3u) << 2u) | ((z & 3u) << 4u);
+      uint64_t* row = &masks[((y >> 2) - brick_min.y) * brick_dim.x +
+                             ((z >> 2) - brick_min.z) * brick_dim.x *
+                                 brick_dim.y];
+
+      for (int32_t bx = x0 >> 2; bx <= (x1 - 1) >> 2; ++bx)
+      {
+        const int32_t lo = glm::max(x0 - bx * 4, 0);
+        const int32_t hi = glm::min(x1 - bx * 4, 4);
+        const uint64_t bits = (0xFu >> (4 - (hi - lo))) << lo;
+        row[bx - brick_min.x] |= bits << row_shift;
+      }
+    }
+
+    // Dithering threshold on 16 bits of the hash
+    const uint32_t threshold =
+        (uint32_t)(glm::clamp(settings.density * settings.density, 0.0f,
+                              1.0f) *
+                   65536.0f);
+
+    uint8_t values[64];
+    uint32_t i = 0u;
+    for (int32_t bz = 0; bz < brick_dim.z; ++bz)
+      for (int32_t by = 0; by < brick_dim.y; ++by)
+        for (int32_t bx = 0; bx < brick_dim.x; ++bx, ++i)
+        {
+          if (!masks[i])
+            continue;
+
+          const glm::ivec3 b = brick_min + glm::ivec3(bx, by, bz);
+
+          // Skip voxels covered by previous stamps
+          uint64_t candidates = visited.or_brick(b.x, b.y, b.z, masks[i]);
+          uint64_t accepted = 0u;
+
+          while (candidates)
+          {
+            const uint32_t bit = std::countr_zero(candidates);
+            candidates &= candidates - 1u;
+
+            const uint32_t x = b.x * 4u + (bit & 3u),
+                           y = b.y * 4u + ((bit >> 2u) & 3u),
+                           z = b.z * 4u + (bit >> 4u);
+
+            const bool solid = data[x + y * dim.x + z * dim.x * dim.y] != 0u;
+            if (solid == (settings.remove_mode == remove_mode_solid))
+              continue;
+
+            const uint32_t hx = mirror_axis_mask & 1u ? dim.x - 1u - x : x,
+                           hy = mirror_axis_mask & 2u ? dim.y - 1u - y : y,
+                           hz = mirror_axis_mask & 4u ? dim.z - 1u - z : z;
+            const uint32_t h = common::hash(
+                sparse_volume_t::pack(hx, hy, hz, 0u) ^ settings.seed);
+            if ((h & 0xFFFFu) >= threshold)
+              continue;
+
+            values[bit] =
+                settings.palette_range
+                    ? settings.palette_range->get_palette_index(h) + 1u
+                    : 0u;
+            accepted |= 1ull << bit;
+          }
+
+          if (accepted)
+            volume.add_brick(b.x, b.y, b.z, accepted, values);
+        }
+  }
+
+  sparse_occupancy_mask_t visited;
+  std::vector<uint64_t> masks;
+
+  bool has_last_stamp{false};
+  io_ref_t last_shape{};
+  glm::ivec3 last_offset{0};
+  glm::ivec3 last_extent{0};
+  bool last_is_sphere{false};
+  uint32_t last_settings_hash{0u};
+};
@@ -0,0 +1,252 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "sparse_volume.h"
+
+// STL
+#include <algorithm>
+#include <bit>
+
+//----------------------------------------------------------------------------//
+// Compact storage for copied voxels. Coordinates are stored relative to the
+// minimum corner of the copied voxels in 4^3 bricks. Each brick stores an
+// occupancy mask, a palette of the distinct voxel values it contains and a
+// bit packed palette index per voxel (zero bits for uniform bricks).
+struct clipboard_t
+{
+  // Copies the selected voxels of the given shape. Selected empty voxels are
+  // copied too, so pasting them clears the voxels at the destination.
+  void copy(io_ref_t shape, const sparse_volume_t& selection)
+  {
+    clear();
+
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    const auto dim = io_component_voxel_shape->get_dim(shape);
+
+    uint32_t min[3] = {255u, 255u, 255u}, max[3] = {0u, 0u, 0u};
+    for (const auto& e : selection.entries)
+    {
+      uint8_t coord[3];
+      sparse_volume_t::unpack(e.data, coord[0], coord[1], coord[2]);
+      if (!sparse_volume_t::is_coord_valid(
+              io_u8vec3_t{coord[0], coord[1], coord[2]}, dim))
+        continue;
+
+      for (uint32_t i = 0u; i < 3u; ++i)
+      {
+        min[i] = std::min(min[i], (uint32_t)coord[i]);
+        max[i] = std::max(max[i], (uint32_t)coord[i]);
+      }
+    }
+
+    if (min[0] > max[0])
+      return;
+
+    origin = {(uint8_t)min[0], (uint8_t)min[1], (uint8_t)min[2]};
+    extent = {(uint16_t)(max[0] - min[0] + 1u),
+              (uint16_t)(max[1] - min[1] + 1u),
+              (uint16_t)(max[2] - min[2] + 1u)};
+
+    // Sort the voxels by brick and by bit within the brick. Keys are stored
+    // as "brick << 14 | bit << 8 | value" with "brick = x | y << 6 | z << 12"
+    keys.clear();
+    keys.reserve(selection.entries.size());
+
+    for (const auto& e : selection.entries)
+    {
+      io_u8vec3_t coord;
+      sparse_volume_t::unpack(e.data, coord.x, coord.y, coord.z);
+      if (!sparse_volume_t::is_coord_valid(coord, dim))
+        continue;
+
+      const uint32_t value =
+          data[coord.x + coord.y * dim.x + coord.z * dim.x * dim.y];
+      const uint32_t x = coord.x - origin.x, y = coord.y - origin.y,
+                     z = coord.z - origin.z;
+
+      const uint32_t brick = (x >> 2u) | (y >> 2u) << 6u | (z >> 2u) << 12u;
+      const uint32_t bit = (x & 3u) | (y & 3u) << 2u | (z & 3u) << 4u;
+      keys.push_back(brick << 14u | bit << 8u | value);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // Local palette index + 1 of each value in the current brick
+    uint8_t local_indices[256] = {};
+
+    for (uint32_t i = 0u; i < keys.size();)
+    {
+      const uint32_t brick = keys[i] >> 14u;
+
+      uint32_t end = i;
+      while (end < keys.size() && (keys[end] >> 14u) == brick)
+        ++end;
+
+      brick_t b = {};
+      b.x = brick & 63u;
+      b.y = (brick >> 6u) & 63u;
+      b.z = brick >> 12u;
+      b.palette_offset = (uint32_t)palettes.size();
+      b.indices_offset = num_index_bits;
+
+      for (uint32_t j = i; j < end; ++j)
+      {
+        const uint32_t value = keys[j] & 0xFFu;
+        b.mask |= 1ull << ((keys[j] >> 8u) & 63u);
+
+        if (local_indices[value] == 0u)
+        {
+          palettes.push_back((uint8_t)value);
+          local_indices[value] =
+              (uint8_t)(palettes.size() - b.palette_offset);
+        }
+      }
+
+      const uint32_t num_values = (uint32_t)palettes.size() - b.palette_offset;
+      b.num_bits = num_values > 1u ? std::bit_width(num_values - 1u) : 0u;
+
+      if (b.num_bits > 0u)
+      {
+        for (uint32_t j = i; j < end; ++j)
+          write_bits(local_indices[keys[j] & 0xFFu] - 1u, b.num_bits);
+      }
+
+      for (uint32_t j = b.palette_offset; j < palettes.size(); ++j)
+        local_indices[palettes[j]] = 0u;
+
+      bricks.push_back(b);
+      num_voxels += end - i;
+      i = end;
+    }
+
+    bricks.shrink_to_fit();
+    palettes.shrink_to_fit();
+    indices.shrink_to_fit();
+  }
+
+  // Calls the given function for each voxel with the coordinate relative to
+  // the minimum corner of the copied voxels and the voxel value
+  template <typename F> void for_each(F&& f) const
+  {
+    for (const auto& b : bricks)
+    {
+      uint64_t mask = b.mask;
+      uint32_t bit_offset = b.indices_offset;
+
+      while (mask)
+      {
+        const uint32_t bit = std::countr_zero(mask);
+        mask &= mask - 1u;
+
+        uint32_t local_index = 0u;
+        if (b.num_bits > 0u)
+        {
+          local_index = read_bits(bit_offset, b.num_bits);
+          bit_offset += b.num_bits;
+        }
+
+        f(b.x * 4u + (bit & 3u), b.y * 4u + (bit >> 2u & 3u),
+          b.z * 4u + (bit >> 4u), palettes[b.palette_offset + local_index]);
+      }
+    }
+  }
+
+  // Pastes the voxels to the given volume. The voxels are rotated in steps of
+  // 90 degrees around the x, y and z axis (in this order) and the minimum
+  // corner of the rotated voxels is placed at the given offset.
+  void paste(sparse_volume_t& volume, io_u16vec3_t dim, io_ivec3_t offset,
+             io_u8vec3_t rotation = {}) const
+  {
+    const auto t = voxel_transform_t::rotation(rotation).fit(extent, offset);
+
+    volume.reserve(volume.entries.size() + num_voxels);
+
+    for_each([&](uint32_t x, uint32_t y, uint32_t z, uint8_t value) {
+      volume.set(t.apply(sparse_volume_t::pack(x, y, z, 0u)), value, dim,
+                 true);
+    });
+  }
+
+  inline auto get_origin() const -> io_u8vec3_t { return origin; }
+  inline auto get_extent() const -> io_u16vec3_t { return extent; }
+  inline auto get_num_voxels() const -> uint32_t { return num_voxels; }
+  inline auto empty() const -> bool { return num_voxels == 0u; }
+
+  void clear()
+  {
+    bricks.clear();
+    palettes.clear();
+    indices.clear();
+    num_index_bits = 0u;
+    num_voxels = 0u;
+    origin = {};
+    extent = {};
+  }
+
+private:
+  struct brick_t
+  {
+    uint64_t mask;
+    uint32_t palette_offset;
+    uint32_t indices_offset; // In bits
+    uint8_t x, y, z;         // In bricks
+    uint8_t num_bits;
+  };
+
+  inline void write_bits(uint32_t value, uint32_t num_bits)
+  {
+    const uint32_t word = num_index_bits >> 6u, shift = num_index_bits & 63u;
+    if (word >= indices.size())
+      indices.push_back(0u);
+
+    indices[word] |= (uint64_t)value << shift;
+    if (shift + num_bits > 64u)
+      indices.push_back((uint64_t)value >> (64u - shift));
+
+    num_index_bits += num_bits;
+  }
+
+  inline auto read_bits(uint32_t offset, uint32_t num_bits) const -> uint32_t
+  {
+    const uint32_t word = offset >> 6u, shift = offset & 63u;
+
+    uint64_t value = indices[word] >> shift;
+    if (shift + num_bits > 64u)
+      value |= indices[word + 1u] << (64u - shift);
+
+    return (uint32_t)value & ((1u << num_bits) - 1u);
+  }
+
+  std::vector<brick_t> bricks;
+  std::vector<uint8_t> palettes;
+  std::vector<uint64_t> indices;
+  uint32_t num_index_bits = 0u;
+  uint32_t num_voxels = 0u;
+
+  io_u8vec3_t origin = {};
+  io_u16vec3_t extent = {};
+
+  // Scratch memory for copying
+  std::vector<uint32_t> keys;
+};
@@ -55,8 +55,14 @@ static const io_base_i* io_base = nullptr;
 static const io_logging_i* io_logging = nullptr;
 static const io_component_node_i* io_component_node = nullptr;
 static const io_component_voxel_shape_i* io_component_voxel_shape = nullptr;
+static const io_component_camera_i* io_component_camera = nullptr;
+// Not registered by older engines
+static const io_component_voxel_shape_region_i*
+    io_component_voxel_shape_region = nullptr;
 static const io_resource_palette_i* io_resource_palette = nullptr;
 static const io_editor_i* io_editor = nullptr;
+// Not registered by older engines
+static const io_editor_selection_i* io_editor_selection = nullptr;
 static const io_world_i* io_world = nullptr;
 static const io_debug_geometry_i* io_debug_geometry = nullptr;
 static const io_input_system_i* io_input_system = nullptr;
@@ -128,6 +134,31 @@ inline io_u8vec3_t decode_8b(uint32_t c)
 }
 } // namespace morton
 
+//----------------------------------------------------------------------------//
+// Bounding box of modified voxels (minimum and maximum coordinate, inclusive)
+struct voxel_aabb_t
+{
+  inline void add(int32_t x, int32_t y, int32_t z)
+  {
+    min = glm::min(min, glm::ivec3(x, y, z));
+    max = glm::max(max, glm::ivec3(x, y, z));
+  }
+
+  inline void add(const voxel_aabb_t& other)
+  {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+
+  inline auto empty() const -> bool
+  {
+    return max.x < min.x || max.y < min.y || max.z < min.z;
+  }
+
+  glm::ivec3 min{INT32_MAX};
+  glm::ivec3 max{INT32_MIN};
+};
+
 namespace common
 {
 //----------------------------------------------------------------------------//
@@ -145,6 +176,155 @@ inline auto hash(const char* data, uint32_t size) -> uint32_t
   return hash;
 }
 
+//----------------------------------------------------------------------------//
+// Stateless integer hash (lowbias32). Hashing a counter yields random numbers
+// which do not depend on the order of evaluation.
+inline auto hash(uint32_t x) -> uint32_t
+{
+  x ^= x >> 16u;
+  x *= 0x7FEB352Du;
+  x ^= x >> 15u;
+  x *= 0x846CA68Bu;
+  x ^= x >> 16u;
+  return x;
+}
+
+//----------------------------------------------------------------------------//
+inline auto hash(__m256i x) -> __m256i
+{
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+  x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7FEB352D));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+  x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int32_t)0x846CA68Bu));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+  return x;
+}
+
+//----------------------------------------------------------------------------//
+// Queues the given region of the shape for voxelization. Falls back to
+// voxelizing the whole shape if the engine doesn't provide region based
+// voxelization.
+inline void voxelize(io_ref_t shape, const voxel_aabb_t& region)
+{
+  if (region.empty())
+    return;
+
+  if (!io_component_voxel_shape_region)
+  {
+    io_component_voxel_shape->voxelize(shape);
+    return;
+  }
+
+  const glm::ivec3 min = glm::clamp(region.min, glm::ivec3(0), glm::ivec3(255));
+  const glm::ivec3 max = glm::clamp(region.max, glm::ivec3(0), glm::ivec3(255));
+  io_component_voxel_shape_region->voxelize_region(
+      shape, {(uint8_t)min.x, (uint8_t)min.y, (uint8_t)min.z},
+      {(uint8_t)max.x, (uint8_t)max.y, (uint8_t)max.z});
+}
+
+//----------------------------------------------------------------------------//
+// Collects the voxel shapes of all selected entities. The shape of the first
+// selected entity always comes first.
+inline void get_selected_shapes(std::vector<io_ref_t>& shapes)
+{
+  static std::vector<io_ref_t> entities;
+  entities.clear();
+  entities.push_back(io_editor->get_first_selected_entity());
+
+  if (io_editor_selection)
+  {
+    io_size_t num_entities = 0u;
+    io_editor_selection->get_selected_entities(nullptr, &num_entities);
+    entities.resize(num_entities + 1u);
+    io_editor_selection->get_selected_entities(&entities[1], &num_entities);
+    entities.resize(num_entities + 1u);
+  }
+
+  shapes.clear();
+  for (const auto entity : entities)
+  {
+    if (!io_ref_is_valid(entity))
+      continue;
+
+    const auto shape =
+        io_component_voxel_shape->base.get_component_for_entity(entity);
+    if (!io_ref_is_valid(shape))
+      continue;
+
+    bool is_duplicate = false;
+    for (const auto s : shapes)
+      is_duplicate |= io_ref_is_equal(s, shape);
+
+    if (!is_duplicate)
+      shapes.push_back(shape);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Returns the world space position of the active camera. Falls back to the
+// origin of the mouse ray if there is no active camera.
+inline auto get_camera_position() -> glm::vec3
+{
+  const io_ref_t camera = io_world->get_active_camera();
+  if (io_ref_is_valid(camera))
+  {
+    const io_ref_t camera_node =
+        io_component_node->base.get_component_for_entity(
+            io_component_camera->base.get_entity(camera));
+    return io_cvt(io_component_node->get_world_position(camera_node));
+  }
+
+  io_vec3_t origin, direction;
+  io_world->calc_mouse_ray(&origin, &direction);
+  return io_cvt(origin);
+}
+
+//----------------------------------------------------------------------------//
+// Maps the box of voxels with the given minimum corner and extent of one shape
+// to the voxel grid of another shape. Only supported if both grids use the
+// same voxel size and their axes are aligned, i.e., differ by rotations in
+// steps of 90 degrees, mirroring and translation. Returns false otherwise.
+inline auto map_box(io_ref_t from, io_ref_t to, glm::ivec3 min,
+                    glm::ivec3 extent, glm::ivec3& mapped_min,
+                    glm::ivec3& mapped_extent) -> bool
+{
+  if (io_ref_is_equal(from, to))
+  {
+    mapped_min = min;
+    mapped_extent = extent;
+    return true;
+  }
+
+  const auto to_local = [from, to](glm::vec3 coord) -> glm::vec3 {
+    const auto world =
+        io_component_voxel_shape->to_world_space(from, io_cvt(coord));
+    return io_cvt(io_component_voxel_shape->to_local_space(to, world));
+  };
+
+  // Each axis has to map to a unit vector along an axis of the target
+  const glm::vec3 origin = to_local(glm::vec3(0.0f));
+  for (uint32_t i = 0u; i < 3u; ++i)
+  {
+    glm::vec3 unit(0.0f);
+    unit[i] = 1.0f;
+    const glm::vec3 axis = glm::abs(to_local(unit) - origin);
+
+    constexpr float eps = 1e-3f;
+    const uint32_t num_zero = (uint32_t)(axis.x < eps) +
+                              (uint32_t)(axis.y < eps) +
+                              (uint32_t)(axis.z < eps);
+    const float length = axis.x + axis.y + axis.z;
+    if (num_zero != 2u || glm::abs(length - 1.0f) > eps)
+      return false;
+  }
+
+  const glm::vec3 c0 = to_local(glm::vec3(min));
+  const glm::vec3 c1 = to_local(glm::vec3(min + extent));
+  mapped_min = glm::ivec3(glm::round(glm::min(c0, c1)));
+  mapped_extent = glm::ivec3(glm::round(glm::abs(c1 - c0)));
+  return true;
+}
+
 //----------------------------------------------------------------------------//
 inline static void srand(io_u8vec3_t coord)
 {
@@ -226,9 +406,76 @@ struct palette_range_t
     return palette_indices[common::rand() % palette_indices.size()];
   }
 
+  // Picks a palette index using the given random number (e.g., the result of
+  // "common::hash")
+  inline auto get_palette_index(uint32_t random) const -> io_uint8_t
+  {
+    return palette_indices[((random >> 16u) * palette_indices.size()) >> 16u];
+  }
+
   std::vector<io_uint8_t> palette_indices;
 };
 
+//----------------------------------------------------------------------------//
+// Table of voxel values ("palette index + 1") matching a reference value.
+// Matching by color (optionally fuzzy) and/or by material parameters is
+// resolved once when building the table instead of per voxel.
+struct palette_match_table_t
+{
+  // Matches all solid voxels
+  inline palette_match_table_t()
+  {
+    memset(matches, 1, sizeof(matches));
+    matches[0] = false;
+  }
+
+  inline palette_match_table_t(io_ref_t palette, io_uint8_t value,
+                               bool match_color, float fuzziness,
+                               bool match_material)
+      : palette_match_table_t()
+  {
+    if (!match_color && !match_material)
+      return;
+
+    const glm::vec3 color =
+        io_cvt(io_resource_palette->get_color(palette, value - 1u));
+    const glm::vec4 material = io_cvt(
+        io_resource_palette->get_material_parameters(palette, value - 1u));
+    const float fuzziness2 = fuzziness * fuzziness;
+
+    for (uint32_t i = 1u; i < 256u; ++i)
+    {
+      if (match_color)
+      {
+        if (fuzziness2 > 0.0f)
+        {
+          const glm::vec3 c =
+              io_cvt(io_resource_palette->get_color(palette, i - 1u));
+          matches[i] = glm::distance2(c, color) < fuzziness2;
+        }
+        else
+        {
+          matches[i] = i == value;
+        }
+      }
+
+      if (match_material && matches[i])
+      {
+        const glm::vec4 m = io_cvt(
+            io_resource_palette->get_material_parameters(palette, i - 1u));
+        matches[i] = m == material;
+      }
+    }
+  }
+
+  inline auto operator[](io_uint8_t value) const -> bool
+  {
+    return matches[value];
+  }
+
+  bool matches[256];
+};
+
 //----------------------------------------------------------------------------//
 #if EDITING_ENABLE_LOGGING > 0
 //----------------------------------------------------------------------------//
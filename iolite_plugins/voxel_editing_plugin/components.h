@@ -0,0 +1,288 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "sparse_volume.h"
+
+// STL
+#include <atomic>
+
+//----------------------------------------------------------------------------//
+// Labels the connected components of the solid voxels of a shape. Voxels are
+// merged using a lock-free union-find: each workload (one z-slab) links its
+// voxels to their already visited neighbors, always attaching the larger root
+// to the smaller one. Roots are thus the smallest linear index of their
+// component, so the final compaction is a single pass in index order.
+struct connected_components_t
+{
+  struct component_t
+  {
+    uint32_t num_voxels;
+    voxel_aabb_t bounds;
+  };
+
+  static constexpr uint32_t empty = UINT32_MAX;
+
+  // Labels all solid voxels of the given shape
+  void label(io_ref_t shape, region_neighborhood_t neighborhood)
+  {
+    data = io_component_voxel_shape->get_voxel_data(shape);
+    dim = glm::ivec3(io_cvt(io_component_voxel_shape->get_dim(shape)));
+    labels.resize((size_t)dim.x * dim.y * dim.z);
+    components.clear();
+
+    // Offsets of the neighbors visited before a voxel (in linear order)
+    num_offsets = 0u;
+    for (int32_t z = -1; z <= 0; ++z)
+      for (int32_t y = -1; y <= 1; ++y)
+        for (int32_t x = -1; x <= 1; ++x)
+        {
+          if (z == 0 && (y > 0 || (y == 0 && x >= 0)))
+            continue;
+
+          const int32_t manhattan = glm::abs(x) + glm::abs(y) + glm::abs(z);
+          if ((neighborhood == region_neighborhood_6 && manhattan > 1) ||
+              (neighborhood == region_neighborhood_18 && manhattan > 2))
+            continue;
+
+          // Linear offset and the borders the neighbor is not available at
+          auto& o = offsets[num_offsets++];
+          o.delta = x + y * dim.x + z * dim.x * dim.y;
+          o.border_mask = (x < 0 ? border_min_x : 0u) |
+                          (x > 0 ? border_max_x : 0u) |
+                          (y < 0 ? border_min_y : 0u) |
+                          (y > 0 ? border_max_y : 0u) |
+                          (z < 0 ? border_min_z : 0u);
+        }
+
+    // Initialize all voxels before linking across slabs
+    for (uint32_t phase = 0u; phase < 2u; ++phase)
+    {
+      union_task_t task;
+      io_init_scheduler_task(&task, dim.z, union_task_t::execute);
+      task.components = this;
+      task.link = phase == 1u;
+
+      io_base->scheduler_enqueue_task(&task);
+      io_base->scheduler_wait_for_task(&task);
+    }
+
+    // Replace the roots with the index of their component and gather the
+    // statistics. Parents always precede their children, so they have
+    // already been replaced.
+    for (int32_t z = 0; z < dim.z; ++z)
+      for (int32_t y = 0; y < dim.y; ++y)
+        for (int32_t x = 0; x < dim.x; ++x)
+        {
+          const uint32_t i = calc_index(x, y, z);
+          uint32_t& l = labels[i];
+          if (l == empty)
+            continue;
+
+          if (l == i)
+          {
+            l = (uint32_t)components.size();
+            components.push_back({0u, {}});
+          }
+          else
+            l = labels[l];
+
+          auto& c = components[l];
+          ++c.num_voxels;
+          c.bounds.add(x, y, z);
+        }
+  }
+
+  // Returns the component of the given voxel or "empty"
+  inline auto get_label(int32_t x, int32_t y, int32_t z) const -> uint32_t
+  {
+    return labels[calc_index(x, y, z)];
+  }
+
+  // Returns the index of the largest component or "empty" if there are none
+  auto find_largest() const -> uint32_t
+  {
+    uint32_t largest = empty;
+    for (uint32_t i = 0u; i < components.size(); ++i)
+    {
+      if (largest == empty ||
+          components[i].num_voxels > components[largest].num_voxels)
+        largest = i;
+    }
+
+    return largest;
+  }
+
+  // Adds the voxels of the given component to the volume using the given
+  // value. If no value is given, the values of the voxels are used.
+  void add_component(uint32_t component, sparse_volume_t& volume,
+                     int32_t value = -1) const
+  {
+    const auto& bounds = components[component].bounds;
+    const io_u16vec3_t max_dim = io_cvt(glm::u16vec3(dim));
+
+    for (int32_t z = bounds.min.z; z <= bounds.max.z; ++z)
+      for (int32_t y = bounds.min.y; y <= bounds.max.y; ++y)
+        for (int32_t x = bounds.min.x; x <= bounds.max.x; ++x)
+        {
+          const uint32_t i = calc_index(x, y, z);
+          if (labels[i] == component)
+            volume.set(x, y, z, value < 0 ? data[i] : (uint8_t)value,
+                       max_dim);
+        }
+  }
+
+  std::vector<component_t> components;
+
+private:
+  inline auto calc_index(int32_t x, int32_t y, int32_t z) const -> uint32_t
+  {
+    return (uint32_t)x + (uint32_t)y * dim.x + (uint32_t)z * dim.x * dim.y;
+  }
+
+  inline auto load(uint32_t i) -> uint32_t
+  {
+    return std::atomic_ref<uint32_t>(labels[i]).load(std::memory_order_relaxed);
+  }
+
+  inline auto find(uint32_t i) -> uint32_t
+  {
+    while (true)
+    {
+      std::atomic_ref<uint32_t> parent(labels[i]);
+      uint32_t p = parent.load(std::memory_order_relaxed);
+      if (p == i)
+        return i;
+
+      // Path halving, only ever points to an ancestor
+      const uint32_t gp =
+          std::atomic_ref<uint32_t>(labels[p]).load(std::memory_order_relaxed);
+      if (gp != p)
+        parent.compare_exchange_weak(p, gp, std::memory_order_relaxed);
+      i = p;
+    }
+  }
+
+  inline void unite(uint32_t a, uint32_t b)
+  {
+    while (true)
+    {
+      a = find(a);
+      b = find(b);
+      if (a == b)
+        return;
+
+      // Attach the larger root to the smaller one
+      if (a < b)
+        std::swap(a, b);
+
+      uint32_t expected = a;
+      if (std::atomic_ref<uint32_t>(labels[a]).compare_exchange_strong(
+              expected, b, std::memory_order_relaxed))
+        return;
+    }
+  }
+
+  // Initializes (or links) the voxels of one z-slab per workload
+  struct union_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      const auto task = (const union_task_t*)task_;
+      auto& c = *task->components;
+      const glm::ivec3 dim = c.dim;
+
+      if (!task->link)
+      {
+        const uint32_t begin = c.calc_index(0, 0, range.x);
+        const uint32_t end = c.calc_index(0, 0, range.y);
+        for (uint32_t i = begin; i < end; ++i)
+          c.labels[i] = c.data[i] != 0u ? i : empty;
+        return;
+      }
+
+      for (int32_t z = range.x; z < (int32_t)range.y; ++z)
+        for (int32_t y = 0; y < dim.y; ++y)
+        {
+          const uint32_t row_border =
+              (y == 0 ? border_min_y : 0u) |
+              (y == dim.y - 1 ? border_max_y : 0u) |
+              (z == 0 ? border_min_z : 0u);
+
+          for (int32_t x = 0; x < dim.x; ++x)
+          {
+            const uint32_t i = c.calc_index(x, y, z);
+            if (c.data[i] == 0u)
+              continue;
+
+            const uint32_t border = row_border |
+                                    (x == 0 ? border_min_x : 0u) |
+                                    (x == dim.x - 1 ? border_max_x : 0u);
+
+            for (uint32_t k = 0u; k < c.num_offsets; ++k)
+            {
+              const auto& o = c.offsets[k];
+              if (border & o.border_mask)
+                continue;
+
+              // Skip neighbors sharing the parent (most of them in solid
+              // regions)
+              const uint32_t j = i + o.delta;
+              if (c.data[j] != 0u && c.load(j) != c.load(i))
+                c.unite(i, j);
+            }
+          }
+        }
+    }
+
+    connected_components_t* components;
+    bool link;
+  };
+
+  const uint8_t* data{nullptr};
+  glm::ivec3 dim{0};
+  std::vector<uint32_t> labels;
+
+  enum border_
+  {
+    border_min_x = 0x01u,
+    border_max_x = 0x02u,
+    border_min_y = 0x04u,
+    border_max_y = 0x08u,
+    border_min_z = 0x10u
+  };
+
+  struct offset_t
+  {
+    int32_t delta;
+    uint32_t border_mask;
+  };
+
+  offset_t offsets[13];
+  uint32_t num_offsets{0u};
+};
+
+//----------------------------------------------------------------------------//
+static connected_components_t connected_components;
@@ -24,6 +24,15 @@
 
 #include "common.h"
 #include "sparse_volume.h"
+#include "brush_stroke.h"
+#include "clipboard.h"
+#include "morphology.h"
+#include "noise.h"
+#include "undo_journal.h"
+#include "voxel_raycast.h"
+
+// STL
+#include <algorithm>
 
 //----------------------------------------------------------------------------//
 namespace editing_tools
@@ -46,6 +55,8 @@ enum tool_
   tool_eyedropper,
   tool_move,
   tool_grass,
+  tool_noise,
+  tool_morphology,
 
   tool_select_box,
   tool_select_wand,
@@ -93,17 +104,28 @@ struct tool_parameters_t
   region_neighborhood_t region_neighborhood{region_neighborhood_6};
   region_type_t region_type{region_type_region};
   float region_fuziness{0.0f};
+  bool region_match_material{false};
 
   region_neighborhood_t face_neighborhood{region_neighborhood_6};
   face_type_t face_type{face_type_region};
   bool face_palette_fill{false};
   float face_fuzziness{0.0f};
+  bool face_match_material{false};
 
   palette_range_t palette_range;
   bool mirror_x{false}, mirror_y{false}, mirror_z{false};
-  sparse_volume_t selection, clipboard;
+  sparse_volume_t selection;
+
+  clipboard_t clipboard;
+  int32_t paste_offset[3]{0, 0, 0};
+  int32_t paste_rotation[3]{0, 0, 0};
 
   float tool_grass_density{0.25f};
+  noise_params_t tool_noise;
+  morph_params_t tool_morphology;
+
+  int32_t island_size{8};
+  region_neighborhood_t island_neighborhood{region_neighborhood_6};
 };
 
 //----------------------------------------------------------------------------//
@@ -142,8 +164,8 @@ static bool trace_volume(io_ref_t shape, const tool_parameters_t& params,
   io_vec3_t o, d;
   io_world->calc_mouse_ray(&o, &d);
 
-  // Raycast against shape's voxels
-  bool hit = io_component_voxel_shape->raycast(shape, o, d, FLT_MAX, &result);
+  // Raycast against shape's voxels (directly on the voxel data)
+  bool hit = voxel_raycaster.raycast(shape, o, d, FLT_MAX, &result);
   bool block = false;
   if (hit)
   {
@@ -185,29 +207,130 @@ static bool trace_volume(io_ref_t shape, const tool_parameters_t& params,
 }
 
 //----------------------------------------------------------------------------//
-static void handle_tool_voxel(io_ref_t shape, const tool_parameters_t& params)
+// Picks the shape under the mouse cursor. Falls back to the first shape if no
+// voxel of any of the shapes is hit.
+static auto pick_shape(const std::vector<io_ref_t>& shapes) -> io_ref_t
+{
+  if (shapes.size() == 1u)
+    return shapes.front();
+
+  io_vec3_t o, d;
+  io_world->calc_mouse_ray(&o, &d);
+
+  // Cull by the bounds first and trace the remaining shapes front to back, so
+  // the occupancy of the raycaster is only gathered for shapes which might
+  // still be hit before the closest hit so far
+  struct candidate_t
+  {
+    float distance;
+    io_ref_t shape;
+  };
+  std::vector<candidate_t> candidates;
+  candidates.reserve(shapes.size());
+
+  for (const auto shape : shapes)
+  {
+    io_component_voxel_shape_raycast_result_t result;
+    if (io_component_voxel_shape->raycast_bounds(shape, o, d, FLT_MAX, false,
+                                                 &result))
+      candidates.push_back({result.distance, shape});
+    // Only the back faces are hit if the ray starts inside of the bounds
+    else if (io_component_voxel_shape->raycast_bounds(shape, o, d, FLT_MAX,
+                                                      true, nullptr))
+      candidates.push_back({0.0f, shape});
+  }
+
+  std::sort(candidates.begin(), candidates.end(),
+            [](const candidate_t& a, const candidate_t& b) {
+              return a.distance < b.distance;
+            });
+
+  io_ref_t closest_shape = shapes.front();
+  float closest_distance = FLT_MAX;
+  for (const auto& c : candidates)
+  {
+    if (c.distance >= closest_distance)
+      break;
+
+    io_component_voxel_shape_raycast_result_t result;
+    if (voxel_raycaster.raycast(c.shape, o, d, closest_distance, &result) &&
+        result.distance < closest_distance)
+    {
+      closest_shape = c.shape;
+      closest_distance = result.distance;
+    }
+  }
+
+  return closest_shape;
+}
+
+//----------------------------------------------------------------------------//
+// Strokes of the brush for each of the selected shapes
+struct shape_stroke_t
+{
+  io_ref_t shape;
+  // Footprint of the brush in the voxel grid of the shape
+  brush_stamp_t brush;
+  // Voxels of the current stroke and of the hovered footprint
+  brush_stroke_t stroke, preview;
+};
+
+//----------------------------------------------------------------------------//
+static void sync_shape_strokes(const std::vector<io_ref_t>& shapes,
+                               std::vector<shape_stroke_t>& strokes)
+{
+  bool in_sync = shapes.size() == strokes.size();
+  for (uint32_t i = 0u; in_sync && i < shapes.size(); ++i)
+    in_sync = io_ref_is_equal(shapes[i], strokes[i].shape);
+
+  if (in_sync)
+    return;
+
+  // Keep the strokes of shapes which are still selected
+  std::vector<shape_stroke_t> synced_strokes(shapes.size());
+  for (uint32_t i = 0u; i < shapes.size(); ++i)
+  {
+    synced_strokes[i].shape = shapes[i];
+    for (auto& s : strokes)
+    {
+      if (io_ref_is_equal(s.shape, shapes[i]))
+        synced_strokes[i] = std::move(s);
+    }
+  }
+
+  strokes = std::move(synced_strokes);
+}
+
+//----------------------------------------------------------------------------//
+// Applies the brush to the shape under the mouse cursor. The footprint is
+// routed to all other given shapes via their transforms, so strokes can span
+// multiple (adjacent) shapes. Shapes whose voxel grid is not aligned to the
+// one of the hovered shape (see "common::map_box") are skipped.
+static void handle_tool_voxel(io_ref_t shape,
+                              const std::vector<io_ref_t>& shapes,
+                              const tool_parameters_t& params)
 {
   auto palette = io_component_voxel_shape->get_palette(shape);
 
   if (!io_ref_is_valid(palette))
     return;
 
-  const auto dim = io_component_voxel_shape->get_dim(shape);
+  // The footprint of the brush is only rebuilt if its extent changes
+  static brush_stamp_t brush;
+  static std::vector<shape_stroke_t> strokes;
+  static uint32_t stroke_seed = (uint32_t)common::rand();
 
-  sparse_volume_t voxels;
+  sync_shape_strokes(shapes, strokes);
 
   io_component_voxel_shape_raycast_result_t result;
   const bool hit = trace_volume(shape, params, result);
+
+  io_ivec3_t offset = {};
   if (hit)
   {
-    common::srand(result.coord);
-
-    // Easier to tweak
-    const float density2 = params.density * params.density;
-
     if (params.tool_shape == tool_shape_voxel_box)
     {
-      auto offset = io_ivec3_t{result.coord.x, result.coord.y, result.coord.z};
+      offset = io_ivec3_t{result.coord.x, result.coord.y, result.coord.z};
       auto extent = io_ivec3_t{params.extent, params.extent, params.extent};
 
       if (!params.tool_shape_is_3d)
@@ -268,28 +391,15 @@ static void handle_tool_voxel(io_ref_t shape, const tool_parameters_t& params)
         }
       }
 
-      for (int32_t z = 0u; z < extent.z; ++z)
-        for (int32_t y = 0u; y < extent.y; ++y)
-          for (int32_t x = 0u; x < extent.x; ++x)
-          {
-            const float r = common::rand_float(0.0f, 1.0f);
-            if (density2 < r)
-              continue;
-
-            const uint8_t value =
-                params.placement_mode != placement_mode_erase
-                    ? (params.palette_range.get_random_palette_index() + 1u)
-                    : 0u;
-            voxels.set(offset.x + x, offset.y + y, offset.z + z, value, dim);
-          }
+      brush.build(false, io_cvt(extent), 0.0f);
     }
     else if (params.tool_shape == tool_shape_voxel_sphere)
     {
       auto extent = io_ivec3_t{params.extent, params.extent, params.extent};
       const auto radius = params.extent * 0.5f;
-      auto offset = io_ivec3_t{(int32_t)glm::ceil(result.coord.x - radius),
-                               (int32_t)glm::ceil(result.coord.y - radius),
-                               (int32_t)glm::ceil(result.coord.z - radius)};
+      offset = io_ivec3_t{(int32_t)glm::ceil(result.coord.x - radius),
+                          (int32_t)glm::ceil(result.coord.y - radius),
+                          (int32_t)glm::ceil(result.coord.z - radius)};
 
       if (!params.tool_shape_is_3d)
       {
@@ -310,78 +420,115 @@ static void handle_tool_voxel(io_ref_t shape, const tool_parameters_t& params)
         }
       }
 
-      const glm::vec3 radius_final = {extent.x * 0.5f, extent.y * 0.5f,
-                                      extent.z * 0.5f};
-
-      for (uint32_t z = 0u; z < extent.z; ++z)
-        for (uint32_t y = 0u; y < extent.y; ++y)
-          for (uint32_t x = 0u; x < extent.x; ++x)
-          {
-            const float r = common::rand_float(0.0f, 1.0f);
-            if (density2 < r)
-              continue;
-
-            const auto coord =
-                (glm::vec3(x, y, z) - radius_final + 0.5f) / radius;
-            if (glm::length(coord) >= 1.0f)
-              continue;
-
-            uint8_t palette_index =
-                params.palette_range.get_random_palette_index() + 1u;
-            if (params.placement_mode == placement_mode_erase)
-              palette_index = 0u;
-
-            voxels.set(offset.x + x, offset.y + y, offset.z + z, palette_index,
-                       dim);
-          }
+      brush.build(true, io_cvt(extent), radius);
     }
   }
 
-  // Remove non-solid voxels?
-  const bool solid_voxels_only =
-      params.placement_mode == placement_mode_paint ||
-      params.placement_mode == placement_mode_erase;
-  if (solid_voxels_only)
-    voxels.remove_voxels<remove_mode_non_solid>(shape);
-  else
-    voxels.remove_voxels<remove_mode_solid>(shape);
-
-  // Apply mirroring (if any)
-  mirror(shape, params, voxels);
+  brush_settings_t settings;
+  settings.density = params.density;
+  settings.seed = stroke_seed;
+  settings.palette_range = params.placement_mode != placement_mode_erase
+                               ? &params.palette_range
+                               : nullptr;
+  // Painting and erasing only affect solid voxels, attaching only empty ones
+  settings.remove_mode = params.placement_mode == placement_mode_paint ||
+                                 params.placement_mode == placement_mode_erase
+                             ? remove_mode_non_solid
+                             : remove_mode_solid;
+  settings.mirror_axis_mask = (uint8_t)params.mirror_x |
+                              (uint8_t)params.mirror_y << 1u |
+                              (uint8_t)params.mirror_z << 2u;
+
+  // Maps the footprint to the voxel grid of the given stroke's shape
+  const auto route_footprint = [&](shape_stroke_t& s, glm::ivec3& o) -> bool {
+    glm::ivec3 extent;
+    if (!common::map_box(shape, s.shape, io_cvt(offset), brush.extent, o,
+                         extent))
+      return false;
+
+    // Boxes and spheres are symmetric, so only the extent has to be permuted
+    s.brush.build(brush.is_sphere, extent, brush.radius);
+    return true;
+  };
+
+  bool is_stroke_empty = true;
+  for (const auto& s : strokes)
+    is_stroke_empty &= s.stroke.volume.empty();
 
-  static sparse_volume_t paint_volume;
   if (is_left_mouse_buttom_pressed())
   {
-    paint_volume.add(voxels, dim);
+    for (auto& s : strokes)
+    {
+      glm::ivec3 o;
+      if (hit && route_footprint(s, o))
+        s.stroke.stamp_to(s.shape, s.brush, o, settings);
+      else
+        s.stroke.lift();
+    }
   }
-  else if (!is_left_mouse_buttom_pressed() && !paint_volume.empty())
+  else
   {
-    const auto current_palette_index =
-        io_component_voxel_shape->get(shape, result.coord);
+    if (!is_stroke_empty)
+    {
+      // Apply the changes to all shapes concurrently and record them as a
+      // single step for undo/redo. The journal only voxelizes the bounds of
+      // the modified voxels.
+      std::vector<undo_journal_t::shape_delta_t> deltas;
+      for (const auto& s : strokes)
+      {
+        if (!s.stroke.volume.empty())
+          deltas.push_back({s.shape, &s.stroke.volume, false});
+      }
 
-    // Undo/redo
-    io_editor->push_undo_redo_state_for_entity(
-        ICON_FA_PEN_TO_SQUARE "   Brush Shape",
-        io_component_voxel_shape->base.get_entity(shape), false);
+      if (undo_journal.apply(deltas, ICON_FA_PEN_TO_SQUARE "   Brush Shape"))
+      {
+        for (const auto& d : deltas)
+        {
+          if (d.changed)
+            io_component_voxel_shape->commit_snapshot(d.shape);
+        }
+      }
 
-    // Apply the changes to the shape
-    paint_volume.apply(shape);
-    // Commit the changes
-    io_component_voxel_shape->commit_snapshot(shape);
-    io_component_voxel_shape->voxelize(shape);
+      // Use a new dithering pattern for the next stroke
+      stroke_seed = (uint32_t)common::rand();
+    }
 
-    paint_volume.clear();
+    for (auto& s : strokes)
+      s.stroke.clear();
   }
 
-  if (paint_volume.empty())
+  // The voxels the previews are based on changed, e.g., by committing a
+  // stroke or by undo/redo
+  static uint32_t preview_revision = 0u;
+  if (preview_revision != undo_journal.get_revision())
   {
-    voxels.cull_for_draw(shape);
-    voxels.draw(shape);
+    for (auto& s : strokes)
+      s.preview.clear();
+    preview_revision = undo_journal.get_revision();
   }
-  else
+
+  for (auto& s : strokes)
   {
-    paint_volume.cull_for_draw(shape);
-    paint_volume.draw(shape, true);
+    if (s.stroke.volume.empty())
+    {
+      // Only rebuild the preview if the footprint changed
+      glm::ivec3 o;
+      if (!hit || !route_footprint(s, o))
+        s.preview.clear();
+      else if (!s.preview.is_last_stamp(s.shape, s.brush, o, settings))
+      {
+        s.preview.clear();
+        s.preview.stamp_to(s.shape, s.brush, o, settings);
+      }
+
+      s.preview.volume.cull_for_draw(s.shape);
+      s.preview.volume.draw(s.shape);
+    }
+    else
+    {
+      s.stroke.volume.cull_for_draw(s.shape);
+      s.stroke.volume.draw(s.shape, true);
+    }
   }
 }
 
@@ -406,9 +553,12 @@ static void handle_tool_select_wand(io_ref_t shape, tool_parameters_t& params)
 
     if (params.region_type != region_type_color)
     {
+      const palette_match_table_t matches(
+          palette, io_component_voxel_shape->get(shape, result.coord),
+          params.region_type == region_type_region_color,
+          params.region_fuziness, params.region_match_material);
       voxels.add_region(shape, result.coord, params.region_neighborhood, 0xFFu,
-                        {}, params.region_type == region_type_region_color,
-                        palette, params.face_fuzziness);
+                        {}, matches);
     }
     else
     {
@@ -522,10 +672,12 @@ static void handle_tool_extrude(io_ref_t shape, tool_parameters_t& params,
       }
 
       voxels.clear();
+      const palette_match_table_t matches(
+          palette, io_component_voxel_shape->get(shape, result.coord),
+          params.face_type == face_type_region_color, params.face_fuzziness,
+          params.face_match_material);
       voxels.add_region(shape, result.coord, params.face_neighborhood,
-                        axis_flags, exclude_dir,
-                        params.face_type == face_type_region_color, palette,
-                        params.face_fuzziness);
+                        axis_flags, exclude_dir, matches);
       if (params.face_palette_fill)
         voxels = voxels.prepare_fill(shape, params.palette_range, true);
 
@@ -594,13 +746,10 @@ static void handle_tool_extrude(io_ref_t shape, tool_parameters_t& params,
 
     if (!is_left_mouse_buttom_pressed())
     {
-      // Undo/redo
-      io_editor->push_undo_redo_state_for_entity(
-          ICON_FA_PEN_TO_SQUARE "   Extrude Shape",
-          io_component_voxel_shape->base.get_entity(shape), false);
-
-      voxels_extruded.apply(shape);
-      io_component_voxel_shape->commit_snapshot(shape);
+      // Apply and record for undo/redo
+      if (undo_journal.apply(shape, voxels_extruded,
+                             ICON_FA_PEN_TO_SQUARE "   Extrude Shape"))
+        io_component_voxel_shape->commit_snapshot(shape);
 
       voxels_extruded.clear();
       voxels.clear();
@@ -730,13 +879,10 @@ static void handle_tool_move(io_ref_t shape, tool_parameters_t& params)
       // Remove voxels
       auto change = voxels_to_move.prepare_erase(shape);
 
-      // Undo/redo
-      io_editor->push_undo_redo_state_for_entity(
-          ICON_FA_PEN_TO_SQUARE "   Move Shape",
-          io_component_voxel_shape->base.get_entity(shape), false);
-
-      change.apply(shape);
-      io_component_voxel_shape->commit_snapshot(shape);
+      // Apply and record for undo/redo
+      if (undo_journal.apply(shape, change,
+                             ICON_FA_PEN_TO_SQUARE "   Move Shape"))
+        io_component_voxel_shape->commit_snapshot(shape);
 
       dragging = true;
     }
@@ -786,17 +932,10 @@ static void handle_tool_move(io_ref_t shape, tool_parameters_t& params)
 
     if (!is_left_mouse_buttom_pressed())
     {
-      // Move voxels
-      auto change = voxels_to_draw;
-      change.update_from_shape(shape);
-
-      // Undo/redo
-      io_editor->push_undo_redo_state_for_entity(
-          ICON_FA_PEN_TO_SQUARE "   Move Shape",
-          io_component_voxel_shape->base.get_entity(shape), false);
-
-      voxels_to_draw.apply(shape);
-      io_component_voxel_shape->commit_snapshot(shape);
+      // Move voxels (and record for undo/redo)
+      if (undo_journal.apply(shape, voxels_to_draw,
+                             ICON_FA_PEN_TO_SQUARE "   Move Shape"))
+        io_component_voxel_shape->commit_snapshot(shape);
 
       // Update selection
       params.selection = voxels_to_draw;
@@ -887,16 +1026,10 @@ static void handle_tool_box(io_ref_t shape, tool_parameters_t& params)
         }
         else
         {
-          auto change = voxels;
-          change.update_from_shape(shape);
-
-          // Undo/redo
-          io_editor->push_undo_redo_state_for_entity(
-              ICON_FA_PEN_TO_SQUARE "   Box Shape",
-              io_component_voxel_shape->base.get_entity(shape), false);
-
-          voxels.apply(shape);
-          io_component_voxel_shape->commit_snapshot(shape);
+          // Apply and record for undo/redo
+          if (undo_journal.apply(shape, voxels,
+                                 ICON_FA_PEN_TO_SQUARE "   Box Shape"))
+            io_component_voxel_shape->commit_snapshot(shape);
         }
 
         dragging = false;
@@ -971,22 +1104,103 @@ static void handle_tool_box(io_ref_t shape, tool_parameters_t& params)
 }
 
 //----------------------------------------------------------------------------//
-static void handle_tool(tool_parameters_t& params)
+// Result of the morphological operation for the current parameters. Only
+// recomputed if the parameters, the selection, or the voxel data changed.
+struct morph_preview_t
 {
-  const auto entity = io_editor->get_first_selected_entity();
-  if (!io_ref_is_valid(entity))
+  sparse_volume_t change;
+
+  io_ref_t shape{};
+  morph_params_t params;
+  uint32_t selection_hash{0u};
+  uint32_t revision{0u};
+  const uint8_t* data{nullptr};
+  io_u16vec3_t dim{};
+  bool valid{false};
+};
+static morph_preview_t morph_preview;
+
+//----------------------------------------------------------------------------//
+static void update_morph_preview(io_ref_t shape,
+                                 const tool_parameters_t& params)
+{
+  const auto& selection = params.selection;
+  const auto& morph = params.tool_morphology;
+
+  uint32_t selection_hash = (uint32_t)selection.entries.size();
+  for (const auto& e : selection.entries)
+    selection_hash = common::hash(selection_hash ^ e.data);
+
+  // The revision only tracks edits recorded in the journal. Compacting the
+  // shape or engine-side undo/redo reallocates or resizes the voxel data and
+  // is caught by the checks below
+  const uint8_t* data = io_component_voxel_shape->get_voxel_data(shape);
+  const auto dim = io_component_voxel_shape->get_dim(shape);
+
+  auto& p = morph_preview;
+  if (p.valid && io_ref_is_equal(p.shape, shape) &&
+      p.params.op == morph.op && p.params.radius == morph.radius &&
+      p.selection_hash == selection_hash &&
+      p.revision == undo_journal.get_revision() && p.data == data &&
+      p.dim.x == dim.x && p.dim.y == dim.y && p.dim.z == dim.z &&
+      !io_component_voxel_shape->is_voxelization_pending(shape))
     return;
 
-  const auto shape =
-      io_component_voxel_shape->base.get_component_for_entity(entity);
+  p.change = morphology.prepare(
+      shape, !selection.empty() ? &selection : nullptr, morph);
+  p.shape = shape;
+  p.params = morph;
+  p.selection_hash = selection_hash;
+  p.revision = undo_journal.get_revision();
+  p.data = data;
+  p.dim = dim;
+  p.valid = true;
+}
+
+//----------------------------------------------------------------------------//
+// Applies the morphological operation to the selection or, if there is no
+// selection, to the whole shape
+static void apply_morphology(io_ref_t shape, const tool_parameters_t& params)
+{
+  // Never apply a cached result, the shape might have been modified in ways
+  // the preview cannot detect
+  morph_preview.valid = false;
+  update_morph_preview(shape, params);
+
+  // Apply and record for undo/redo
+  if (undo_journal.apply(shape, morph_preview.change,
+                         ICON_FA_PEN_TO_SQUARE "   Morph Shape"))
+    io_component_voxel_shape->commit_snapshot(shape);
+
+  morph_preview.valid = false;
+}
+
+//----------------------------------------------------------------------------//
+static void handle_tool_morphology(io_ref_t shape,
+                                   const tool_parameters_t& params)
+{
+  update_morph_preview(shape, params);
+
+  morph_preview.change.cull_for_draw(shape);
+  morph_preview.change.draw(shape);
+}
+
+//----------------------------------------------------------------------------//
+static void handle_tool(tool_parameters_t& params)
+{
+  static std::vector<io_ref_t> shapes;
+  common::get_selected_shapes(shapes);
 
-  if (!io_ref_is_valid(shape))
+  if (shapes.empty())
     return;
 
+  // All tools but the brush operate on the first selected shape
+  const auto shape = shapes.front();
+
   if (params.tool == tool_modify)
   {
     if (params.tool_shape != tool_shape_box)
-      handle_tool_voxel(shape, params);
+      handle_tool_voxel(pick_shape(shapes), shapes, params);
     else
       handle_tool_box(shape, params);
   }
@@ -1014,6 +1228,10 @@ static void handle_tool(tool_parameters_t& params)
   {
     handle_tool_grass(shape, params);
   }
+  else if (params.tool == tool_morphology)
+  {
+    handle_tool_morphology(shape, params);
+  }
 
   if (!params.selection.empty())
   {
@@ -26,6 +26,7 @@
 #include "sparse_volume.h"
 #include "editing.h"
 #include "editing_tools.h"
+#include "shape_stats.h"
 
 namespace editing_ui
 {
@@ -154,6 +155,20 @@ static void toggle_button_group(const char* label, ImVec2 size, T& enum_state,
 //----------------------------------------------------------------------------//
 static editing_tools::tool_parameters_t current_tool_params;
 
+//----------------------------------------------------------------------------//
+static void copy_to_clipboard(io_ref_t shape)
+{
+  auto& params = current_tool_params;
+  params.clipboard.copy(shape, params.selection);
+
+  // Paste to the original location by default
+  const auto origin = params.clipboard.get_origin();
+  params.paste_offset[0] = origin.x;
+  params.paste_offset[1] = origin.y;
+  params.paste_offset[2] = origin.z;
+  memset(params.paste_rotation, 0, sizeof(params.paste_rotation));
+}
+
 //----------------------------------------------------------------------------//
 void show_editing_toolbar()
 {
@@ -257,6 +272,18 @@ void show_editing_toolbar()
                             current_tool_params.tool,
                             editing_tools::tool_grass);
         show_tooltip("Grass: Grass tool. Behaves similar to the extrude tool.");
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_MOUNTAIN "###tool_noise", tb_button_size,
+                            current_tool_params.tool,
+                            editing_tools::tool_noise);
+        show_tooltip("Noise: Fills, erodes, or paints the selection or the "
+                     "whole shape using procedural noise.");
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_DROPLET "###tool_morphology",
+                            tb_button_size, current_tool_params.tool,
+                            editing_tools::tool_morphology);
+        show_tooltip("Morphology: Dilates, erodes, or smooths the selection "
+                     "or the whole shape.");
       }
 
       if (current_tool_params.tool == editing_tools::tool_modify ||
@@ -371,13 +398,10 @@ void show_editing_toolbar()
             const auto change = current_tool_params.selection.prepare_fill(
                 shape, current_tool_params.palette_range);
 
-            // Undo/redo
-            io_editor->push_undo_redo_state_for_entity(
-                ICON_FA_FILL_DRIP "   Fill Shape",
-                io_component_voxel_shape->base.get_entity(shape), false);
-
-            change.apply(shape);
-            io_component_voxel_shape->commit_snapshot(shape);
+            // Apply and record for undo/redo
+            if (undo_journal.apply(shape, change,
+                                   ICON_FA_FILL_DRIP "   Fill Shape"))
+              io_component_voxel_shape->commit_snapshot(shape);
           }
           show_tooltip("Fill: Fills the selected voxels.");
           SAME_LINE_GROUP();
@@ -387,42 +411,75 @@ void show_editing_toolbar()
             const auto change =
                 current_tool_params.selection.prepare_erase(shape);
 
-            // Undo/redo
-            io_editor->push_undo_redo_state_for_entity(
-                ICON_FA_FILL_DRIP "   Fill Shape",
-                io_component_voxel_shape->base.get_entity(shape), false);
-
-            change.apply(shape);
-            io_component_voxel_shape->commit_snapshot(shape);
+            // Apply and record for undo/redo
+            if (undo_journal.apply(shape, change,
+                                   ICON_FA_ERASER "   Erase Shape"))
+              io_component_voxel_shape->commit_snapshot(shape);
           }
           show_tooltip("Erase: Erases the selected voxels.");
 
+          SAME_LINE_GROUP();
+          if (ImGui::Button(ICON_FA_OBJECT_GROUP "###select_largest",
+                            tb_button_size))
+          {
+            current_tool_params.selection = editing::select_largest_component(
+                shape, current_tool_params.island_neighborhood);
+          }
+          show_tooltip("Select Largest: Selects the largest group of connected "
+                       "voxels (see \"Islands\").");
+
           SAME_LINE_RESET();
           SAME_LINE_GROUP();
-          if (ImGui::Button(ICON_FA_COPY "###copy_selection", tb_button_size))
+          if (ImGui::Button(ICON_FA_ROTATE_RIGHT "###rotate_selection",
+                            tb_button_size))
           {
-            current_tool_params.clipboard = current_tool_params.selection;
-            current_tool_params.clipboard.update_from_shape(shape);
+            const auto change = editing::prepare_transform_selection(
+                shape, current_tool_params.selection,
+                voxel_transform_t::rotation({0u, 1u, 0u}));
+
+            // Apply and record for undo/redo
+            if (undo_journal.apply(shape, change,
+                                   ICON_FA_ROTATE_RIGHT "   Rotate Selection"))
+              io_component_voxel_shape->commit_snapshot(shape);
           }
+          show_tooltip("Rotate: Rotates the selected voxels by 90 degrees "
+                       "around the Y axis.");
+
+          SAME_LINE_GROUP();
+          if (ImGui::Button(ICON_FA_RIGHT_LEFT "###transpose_selection",
+                            tb_button_size))
+          {
+            const auto change = editing::prepare_transform_selection(
+                shape, current_tool_params.selection,
+                voxel_transform_t::transpose(0u, 2u));
+
+            // Apply and record for undo/redo
+            if (undo_journal.apply(shape, change,
+                                   ICON_FA_RIGHT_LEFT "   Transpose Selection"))
+              io_component_voxel_shape->commit_snapshot(shape);
+          }
+          show_tooltip("Transpose: Swaps the X and Z axes of the selected "
+                       "voxels.");
+
+          SAME_LINE_RESET();
+          SAME_LINE_GROUP();
+          if (ImGui::Button(ICON_FA_COPY "###copy_selection", tb_button_size))
+            copy_to_clipboard(shape);
           show_tooltip("Copy: Copies the selected voxels.");
 
           SAME_LINE_GROUP();
           if (ImGui::Button(ICON_FA_SCISSORS "###cut_selection",
                             tb_button_size))
           {
-            current_tool_params.clipboard = current_tool_params.selection;
-            current_tool_params.clipboard.update_from_shape(shape);
+            copy_to_clipboard(shape);
 
             const auto change =
-                current_tool_params.clipboard.prepare_erase(shape);
-
-            // Undo/redo
-            io_editor->push_undo_redo_state_for_entity(
-                ICON_FA_SCISSORS "   Cut Shape",
-                io_component_voxel_shape->base.get_entity(shape), false);
+                current_tool_params.selection.prepare_erase(shape);
 
-            change.apply(shape);
-            io_component_voxel_shape->commit_snapshot(shape);
+            // Apply and record for undo/redo
+            if (undo_journal.apply(shape, change,
+                                   ICON_FA_SCISSORS "   Cut Shape"))
+              io_component_voxel_shape->commit_snapshot(shape);
           }
           show_tooltip("Cut: Cuts the selected voxels.");
 
@@ -430,14 +487,52 @@ void show_editing_toolbar()
           ImGui::BeginDisabled(current_tool_params.clipboard.empty());
           if (ImGui::Button(ICON_FA_PASTE "###paste_selection", tb_button_size))
           {
-            io_editor->push_undo_redo_state_for_entity(
-                ICON_FA_PASTE "   Paste Shape",
-                io_component_voxel_shape->base.get_entity(shape), false);
+            const auto& offset = current_tool_params.paste_offset;
+            const auto& rotation = current_tool_params.paste_rotation;
+
+            sparse_volume_t change;
+            current_tool_params.clipboard.paste(
+                change, io_component_voxel_shape->get_dim(shape),
+                {offset[0], offset[1], offset[2]},
+                {(uint8_t)rotation[0], (uint8_t)rotation[1],
+                 (uint8_t)rotation[2]});
+
+            // Apply and record for undo/redo
+            if (undo_journal.apply(shape, change,
+                                   ICON_FA_PASTE "   Paste Shape"))
+              io_component_voxel_shape->commit_snapshot(shape);
+          }
+          show_tooltip("Paste: Pastes the previously copied/cut voxels. Works "
+                       "across shapes.");
+
+          ImGui::SetNextItemWidth(-1.0f);
+          ImGui::DragInt3("###paste_offset", current_tool_params.paste_offset,
+                          1.0f, -255, 255);
+          show_tooltip("The coordinate the minimum corner of the pasted "
+                       "voxels is placed at.");
 
-            current_tool_params.clipboard.apply(shape);
-            io_component_voxel_shape->commit_snapshot(shape);
+          SAME_LINE_RESET();
+          const char* rotate_labels[] = {"X###paste_rotate_x",
+                                         "Y###paste_rotate_y",
+                                         "Z###paste_rotate_z"};
+          for (uint32_t i = 0u; i < 3u; ++i)
+          {
+            SAME_LINE_GROUP();
+            auto& rotation = current_tool_params.paste_rotation[i];
+
+            // Highlight rotated axes
+            const ImVec4& color_selected =
+                ImGui::GetStyle().Colors[ImGuiCol_CheckMark];
+            const bool is_rotated = rotation != 0;
+            if (is_rotated)
+              ImGui::PushStyleColor(ImGuiCol_Text, color_selected);
+            if (ImGui::Button(rotate_labels[i], tb_button_size))
+              rotation = (rotation + 1) % 4;
+            if (is_rotated)
+              ImGui::PopStyleColor();
+            show_tooltip("Rotates the pasted voxels by 90 degrees around the "
+                         "given axis.");
           }
-          show_tooltip("Paste: Pastes the previously copied/cut voxels.");
           ImGui::EndDisabled();
         }
       }
@@ -467,6 +562,15 @@ void show_editing_toolbar()
         show_tooltip("Select voxels which are connected and share the same "
                      "palette color.");
 
+        if (current_tool_params.region_type != editing_tools::region_type_color)
+        {
+          SAME_LINE_GROUP();
+          toggle_button(ICON_FA_GEM "###region_match_material", tb_button_size,
+                        current_tool_params.region_match_material);
+          show_tooltip("Only select voxels which share the same material "
+                       "parameters.");
+        }
+
         if (current_tool_params.region_type ==
             editing_tools::region_type_region_color)
         {
@@ -517,6 +621,135 @@ void show_editing_toolbar()
       }
     }
 
+    if (current_tool_params.tool == editing_tools::tool_noise)
+    {
+      auto& noise = current_tool_params.tool_noise;
+
+      ImGui::Text("Noise");
+      {
+        ImGui::Spacing();
+
+        SAME_LINE_RESET();
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_CUBE "###noise_fill", tb_button_size,
+                            noise.mode, noise_mode_fill);
+        show_tooltip("Fill: Fills empty voxels where the noise exceeds the "
+                     "threshold.");
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_ERASER "###noise_erode", tb_button_size,
+                            noise.mode, noise_mode_erode);
+        show_tooltip("Erode: Removes solid voxels where the noise is below "
+                     "the threshold.");
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_PAINTBRUSH "###noise_paint",
+                            tb_button_size, noise.mode, noise_mode_paint);
+        show_tooltip("Paint: Changes the color of solid voxels. The selected "
+                     "palette colors are used as a gradient.");
+
+        if (noise.mode != noise_mode_paint)
+        {
+          ImGui::SetNextItemWidth(-1.0f);
+          ImGui::SliderFloat("###noise_threshold", &noise.threshold, 0.0f,
+                             1.0f);
+          show_tooltip("The threshold the noise is compared against.");
+        }
+
+        ImGui::SetNextItemWidth(-1.0f);
+        ImGui::DragFloat("###noise_scale", &noise.scale, 0.1f, 1.0f, 256.0f);
+        show_tooltip("The size of the largest features (in voxels).");
+        ImGui::SetNextItemWidth(-1.0f);
+        ImGui::SliderInt("###noise_octaves", &noise.octaves, 1, 8);
+        show_tooltip("The number of octaves. More octaves add finer "
+                     "details.");
+        ImGui::SetNextItemWidth(-1.0f);
+        ImGui::SliderFloat("###noise_gain", &noise.gain, 0.0f, 1.0f);
+        show_tooltip("The amplitude of each octave relative to the previous "
+                     "one.");
+        ImGui::SetNextItemWidth(-1.0f);
+        ImGui::SliderFloat("###noise_lacunarity", &noise.lacunarity, 1.0f,
+                           4.0f);
+        show_tooltip("The frequency of each octave relative to the previous "
+                     "one.");
+
+        ImGui::Spacing();
+
+        SAME_LINE_RESET();
+        SAME_LINE_GROUP();
+        if (ImGui::Button(ICON_FA_DICE "###noise_seed", tb_button_size))
+          noise.seed = (uint32_t)common::rand();
+        show_tooltip("Randomizes the noise.");
+        SAME_LINE_GROUP();
+        if (ImGui::Button(ICON_FA_PLAY "###noise_apply", tb_button_size))
+        {
+          auto& selection = current_tool_params.selection;
+          if (!selection.empty())
+          {
+            const auto change = editing::prepare_noise(
+                shape, selection, current_tool_params.palette_range, noise);
+
+            // Apply and record for undo/redo
+            if (undo_journal.apply(shape, change,
+                                   ICON_FA_MOUNTAIN "   Noise Shape"))
+              io_component_voxel_shape->commit_snapshot(shape);
+          }
+          else
+          {
+            editing::global_noise(shape, current_tool_params.palette_range,
+                                  noise);
+            shape_changed = true;
+          }
+        }
+        show_tooltip("Applies the noise to the selected voxels or, if there "
+                     "is no selection, to the whole shape.");
+      }
+    }
+
+    if (current_tool_params.tool == editing_tools::tool_morphology)
+    {
+      auto& morph = current_tool_params.tool_morphology;
+
+      ImGui::Text("Morphology");
+      {
+        ImGui::Spacing();
+
+        SAME_LINE_RESET();
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_EXPAND "###morph_dilate", tb_button_size,
+                            morph.op, morph_op_dilate);
+        show_tooltip("Dilate: Grows the solid voxels by the radius.");
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_COMPRESS "###morph_erode", tb_button_size,
+                            morph.op, morph_op_erode);
+        show_tooltip("Erode: Shrinks the solid voxels by the radius.");
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_DROPLET "###morph_smooth", tb_button_size,
+                            morph.op, morph_op_smooth);
+        show_tooltip("Smooth: Fills gaps and removes features smaller than "
+                     "the radius.");
+
+        SAME_LINE_RESET();
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_SCISSORS "###morph_open", tb_button_size,
+                            morph.op, morph_op_open);
+        show_tooltip("Open: Removes features smaller than the radius.");
+        SAME_LINE_GROUP();
+        toggle_button_group(ICON_FA_FILL "###morph_close", tb_button_size,
+                            morph.op, morph_op_close);
+        show_tooltip("Close: Fills gaps and holes smaller than the radius.");
+
+        ImGui::SetNextItemWidth(-1.0f);
+        ImGui::SliderFloat("###morph_radius", &morph.radius, 1.0f, 16.0f);
+        show_tooltip("The radius of the operation (in voxels).");
+
+        SAME_LINE_RESET();
+        SAME_LINE_GROUP();
+        if (ImGui::Button(ICON_FA_PLAY "###morph_apply", tb_button_size))
+          editing_tools::apply_morphology(shape, current_tool_params);
+        show_tooltip("Applies the previewed operation to the selected voxels "
+                     "or, if there is no selection, to the whole shape.");
+      }
+    }
+
     if (current_tool_params.tool == editing_tools::tool_extrude ||
         current_tool_params.tool == editing_tools::tool_grass)
     {
@@ -541,6 +774,11 @@ void show_editing_toolbar()
                             editing_tools::face_type_region_color);
         show_tooltip("Select voxels which are connected and share the same "
                      "palette color.");
+        SAME_LINE_GROUP();
+        toggle_button(ICON_FA_GEM "###face_match_material", tb_button_size,
+                      current_tool_params.face_match_material);
+        show_tooltip("Only select voxels which share the same material "
+                     "parameters.");
 
         if (current_tool_params.face_type ==
             editing_tools::face_type_region_color)
@@ -575,6 +813,39 @@ void show_editing_toolbar()
       }
     }
 
+    ImGui::Text("History");
+    {
+      ImGui::Spacing();
+
+      SAME_LINE_RESET();
+      SAME_LINE_GROUP();
+      ImGui::BeginDisabled(!undo_journal.can_undo());
+      if (ImGui::Button(ICON_FA_ARROW_ROTATE_LEFT "###undo", tb_button_size))
+        undo_journal.undo();
+      ImGui::EndDisabled();
+      show_tooltip("Undo: Reverts the last voxel edit.");
+
+      SAME_LINE_GROUP();
+      ImGui::BeginDisabled(!undo_journal.can_redo());
+      if (ImGui::Button(ICON_FA_ARROW_ROTATE_RIGHT "###redo", tb_button_size))
+        undo_journal.redo();
+      ImGui::EndDisabled();
+      show_tooltip("Redo: Reapplies the last reverted voxel edit.");
+
+      SAME_LINE_GROUP();
+      toggle_button(ICON_FA_CAMERA "###engine_snapshots", tb_button_size,
+                    undo_journal.use_engine_snapshots_for_global_ops);
+      show_tooltip("Use the undo/redo stack of the editor for global and "
+                   "boolean operations instead of the journal. These edits "
+                   "are then only reverted via CTRL+Z in the editor.");
+
+      SAME_LINE_GROUP();
+      ImGui::TextDisabled(ICON_FA_CIRCLE_INFO);
+      show_tooltip("Voxel edits are recorded by the plugin. Use the buttons "
+                   "above to undo/redo them, CTRL+Z and CTRL+Y only revert "
+                   "the remaining changes made in the editor.");
+    }
+
     ImGui::Text("Global");
     {
       ImGui::Spacing();
@@ -624,6 +895,56 @@ void show_editing_toolbar()
           "Invert: Fills all empty voxels and removes all solid voxels.");
     }
 
+    ImGui::Text("Islands");
+    {
+      ImGui::Spacing();
+
+      SAME_LINE_RESET();
+      SAME_LINE_GROUP();
+      toggle_button_group("6###islands_6", tb_button_size,
+                          current_tool_params.island_neighborhood,
+                          region_neighborhood_6);
+      show_tooltip("Voxels are connected via their six sides.");
+      SAME_LINE_GROUP();
+      toggle_button_group("18###islands_18", tb_button_size,
+                          current_tool_params.island_neighborhood,
+                          region_neighborhood_18);
+      show_tooltip("Voxels are connected via their sides and edges.");
+      SAME_LINE_GROUP();
+      toggle_button_group("26###islands_26", tb_button_size,
+                          current_tool_params.island_neighborhood,
+                          region_neighborhood_26);
+      show_tooltip("Voxels are connected via their sides, edges, and "
+                   "corners.");
+
+      ImGui::PushItemWidth(tb_button_size.x * 3.0f +
+                           ImGui::GetStyle().ItemInnerSpacing.x * 4.0f);
+
+      if (ImGui::Button(ICON_FA_BROOM "###remove_islands", tb_button_size))
+      {
+        const auto change = editing::prepare_remove_islands(
+            shape, (uint32_t)current_tool_params.island_size,
+            current_tool_params.island_neighborhood);
+
+        // Apply and record for undo/redo
+        if (undo_journal.apply(shape, change,
+                               ICON_FA_BROOM "   Remove Islands"))
+          io_component_voxel_shape->commit_snapshot(shape);
+      }
+      show_tooltip("Remove Islands: Removes groups of connected voxels "
+                   "smaller than the given size, e.g., floating voxels left "
+                   "behind by boolean operations.");
+
+      ImGui::SameLine();
+
+      ImGui::SetNextItemWidth(-1.0f);
+      ImGui::DragInt("###island_size", &current_tool_params.island_size, 1.0f,
+                     1, 65536);
+      show_tooltip("The minimum number of voxels of a group to keep.");
+
+      ImGui::PopItemWidth();
+    }
+
     ImGui::Text("Boolean");
     {
       ImGui::Spacing();
@@ -678,6 +999,94 @@ void show_editing_toolbar()
       ImGui::EndDisabled();
     }
 
+    ImGui::Text("Statistics");
+    {
+      ImGui::Spacing();
+
+      // Analyze the shape again if it got selected or edited
+      static io_ref_t stats_shape = io_ref_invalid();
+      static uint32_t stats_revision = 0u;
+      bool refresh = shape_changed || !io_ref_is_equal(stats_shape, shape) ||
+                     stats_revision != undo_journal.get_revision();
+
+      SAME_LINE_RESET();
+      SAME_LINE_GROUP();
+      if (ImGui::Button(ICON_FA_ARROWS_ROTATE "###refresh_stats",
+                        tb_button_size))
+        refresh = true;
+      show_tooltip("Refresh: Analyzes the selected shape again, e.g., after "
+                   "it was modified outside of the voxel editor.");
+
+      if (refresh && io_ref_is_valid(shape))
+        shape_analysis.request(shape);
+      stats_shape = shape;
+      stats_revision = undo_journal.get_revision();
+      shape_analysis.update();
+
+      if (shape_analysis.is_busy())
+      {
+        ImGui::SameLine();
+        ImGui::TextDisabled(ICON_FA_HOURGLASS_HALF);
+      }
+
+      if (shape_analysis.has_stats_for(shape))
+      {
+        const auto& stats = shape_analysis.get_stats();
+        const auto percentage = [](uint64_t value, uint64_t total) {
+          return total ? value * 100.0f / total : 0.0f;
+        };
+
+        char tooltip[256];
+
+        ImGui::Text("Solid   %5.1f%%",
+                    percentage(stats.num_solid, stats.num_voxels));
+        snprintf(tooltip, sizeof(tooltip),
+                 "%llu of %llu voxels (%dx%dx%d) are solid.",
+                 (unsigned long long)stats.num_solid,
+                 (unsigned long long)stats.num_voxels, stats.dim.x,
+                 stats.dim.y, stats.dim.z);
+        show_tooltip(tooltip);
+
+        ImGui::Text("Surface %5.1f%%",
+                    percentage(stats.num_surface, stats.num_solid));
+        snprintf(tooltip, sizeof(tooltip),
+                 "%llu solid voxels have at least one empty neighbor. The "
+                 "remaining voxels are hidden inside the shape.",
+                 (unsigned long long)stats.num_surface);
+        show_tooltip(tooltip);
+
+        ImGui::Text("RLE     %5.1f%%",
+                    percentage(stats.calc_rle_size(), stats.calc_raw_size()));
+        snprintf(tooltip, sizeof(tooltip),
+                 "%llu runs along x (longest %u) take %.1f KiB when run-length "
+                 "encoded compared to %.1f KiB uncompressed.",
+                 (unsigned long long)stats.num_runs, stats.max_run_length,
+                 stats.calc_rle_size() / 1024.0f,
+                 stats.calc_raw_size() / 1024.0f);
+        show_tooltip(tooltip);
+
+        ImGui::Text("Empty   %5.1f%%",
+                    percentage(stats.num_empty_bricks, stats.num_bricks));
+        snprintf(tooltip, sizeof(tooltip),
+                 "%u of %u bricks of %d^3 voxels are empty and %u are full.",
+                 stats.num_empty_bricks, stats.num_bricks,
+                 shape_stats_t::brick_size, stats.num_full_bricks);
+        show_tooltip(tooltip);
+
+        float histogram[255];
+        for (uint32_t i = 0u; i < 255u; ++i)
+          histogram[i] = (float)stats.palette_histogram[i];
+
+        ImGui::Text("Colors  %u", stats.num_used_palette_indices);
+        ImGui::PlotHistogram("###palette_histogram", histogram, 255, 0,
+                             nullptr, 0.0f, FLT_MAX,
+                             ImVec2(tb_button_size.x * 3.0f +
+                                        ImGui::GetStyle().ItemSpacing.x * 2.0f,
+                                    ImGui::GetFrameHeight() * 2.0f));
+        show_tooltip("The number of voxels per palette index.");
+      }
+    }
+
     ImGui::EndDisabled();
 
     if (shape_changed)
@@ -0,0 +1,397 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "sparse_volume.h"
+
+// STL
+#include <cfloat>
+
+//----------------------------------------------------------------------------//
+enum morph_op_
+{
+  morph_op_dilate,
+  morph_op_erode,
+  morph_op_open,  // Erode, then dilate: removes small features
+  morph_op_close, // Dilate, then erode: fills small holes and gaps
+  morph_op_smooth // Close, then open
+};
+using morph_op_t = int32_t;
+
+//----------------------------------------------------------------------------//
+struct morph_params_t
+{
+  morph_op_t op{morph_op_smooth};
+  float radius{1.5f}; // In voxels
+};
+
+//----------------------------------------------------------------------------//
+// Morphological operations based on the Euclidean distance transform of the
+// occupancy of a region of a shape. The squared distances are computed in
+// three separable passes (a linear scan along x, followed by the lower
+// envelope of parabolas along y and z, Felzenszwalb and Huttenlocher 2012).
+// Each pass is spread to the scheduler, one slab of lines per workload. Along
+// with the distance, each voxel carries the value of the closest solid voxel,
+// so dilated voxels inherit the color of their surroundings.
+struct morphology_t
+{
+  // Returns the changes applying the given operation to the shape results in.
+  // If a selection is given, only the selected voxels are considered solid.
+  // Solid voxels which are not selected are neither filled nor eroded from.
+  auto prepare(io_ref_t shape, const sparse_volume_t* selection,
+               const morph_params_t& params) -> sparse_volume_t
+  {
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    const auto shape_dim = io_component_voxel_shape->get_dim(shape);
+    const glm::ivec3 sdim = glm::ivec3(io_cvt(shape_dim));
+
+    // The region covers the selection plus a margin wide enough for two
+    // consecutive operations
+    const int32_t margin = 2 * (int32_t)glm::ceil(params.radius) + 1;
+    voxel_aabb_t bounds;
+    if (selection)
+    {
+      for (const auto& e : selection->entries)
+      {
+        uint8_t x, y, z;
+        sparse_volume_t::unpack(e.data, x, y, z);
+        bounds.add(x, y, z);
+      }
+    }
+    else
+    {
+      bounds.add(0, 0, 0);
+      bounds.add(sdim.x - 1, sdim.y - 1, sdim.z - 1);
+    }
+
+    sparse_volume_t change;
+    if (bounds.empty())
+      return change;
+
+    region_min = glm::max(bounds.min - margin, glm::ivec3(0));
+    const glm::ivec3 region_max = glm::min(bounds.max + margin, sdim - 1);
+    dim = region_max - region_min + 1;
+    if (dim.x <= 0 || dim.y <= 0 || dim.z <= 0)
+      return change;
+
+    const size_t num_voxels = (size_t)dim.x * dim.y * dim.z;
+    values.assign(num_voxels, 0u);
+    blocked.assign(num_voxels, 0u);
+    dist.resize(num_voxels);
+    labels.resize(num_voxels);
+
+    const auto shape_index = [&](int32_t x, int32_t y, int32_t z) -> size_t {
+      return (size_t)(region_min.x + x) + (region_min.y + y) * sdim.x +
+             (size_t)(region_min.z + z) * sdim.x * sdim.y;
+    };
+
+    for (int32_t z = 0; z < dim.z; ++z)
+      for (int32_t y = 0; y < dim.y; ++y)
+      {
+        const uint8_t* src = &data[shape_index(0, y, z)];
+        if (!selection)
+        {
+          memcpy(&values[calc_index(0, y, z)], src, dim.x);
+          continue;
+        }
+
+        // Block all solid voxels first, the selected ones are unblocked below
+        uint8_t* b = &blocked[calc_index(0, y, z)];
+        for (int32_t x = 0; x < dim.x; ++x)
+          b[x] = src[x] != 0u;
+      }
+
+    if (selection)
+    {
+      for (const auto& e : selection->entries)
+      {
+        io_u8vec3_t c;
+        sparse_volume_t::unpack(e.data, c.x, c.y, c.z);
+        if (!sparse_volume_t::is_coord_valid(c, shape_dim))
+          continue;
+
+        const glm::ivec3 l = glm::ivec3(c.x, c.y, c.z) - region_min;
+        const size_t i = calc_index(l.x, l.y, l.z);
+        values[i] = data[shape_index(l.x, l.y, l.z)];
+        blocked[i] = 0u;
+      }
+    }
+
+    const float r = params.radius;
+    switch (params.op)
+    {
+    case morph_op_dilate:
+      dilate(r);
+      break;
+    case morph_op_erode:
+      erode(r);
+      break;
+    case morph_op_open:
+      erode(r);
+      dilate(r);
+      break;
+    case morph_op_close:
+      dilate(r);
+      erode(r);
+      break;
+    case morph_op_smooth:
+      dilate(r);
+      erode(r);
+      erode(r);
+      dilate(r);
+      break;
+    }
+
+    // Collect the changes, skipping blocked voxels
+    for (int32_t z = 0; z < dim.z; ++z)
+      for (int32_t y = 0; y < dim.y; ++y)
+      {
+        const uint8_t* src = &data[shape_index(0, y, z)];
+        const uint8_t* dst = &values[calc_index(0, y, z)];
+        const uint8_t* b = &blocked[calc_index(0, y, z)];
+
+        for (int32_t x = 0; x < dim.x; ++x)
+        {
+          if (src[x] == dst[x] || b[x])
+            continue;
+
+          change.set(region_min.x + x, region_min.y + y, region_min.z + z,
+                     dst[x], shape_dim);
+        }
+      }
+
+    return change;
+  }
+
+private:
+  static constexpr float inf = FLT_MAX;
+
+  inline auto calc_index(int32_t x, int32_t y, int32_t z) const -> size_t
+  {
+    return (size_t)x + (size_t)y * dim.x + (size_t)z * dim.x * dim.y;
+  }
+
+  // Fills empty voxels within the given distance of solid voxels
+  void dilate(float radius)
+  {
+    transform(true);
+
+    const float r2 = radius * radius;
+    for (size_t i = 0u; i < values.size(); ++i)
+    {
+      if (values[i] == 0u && !blocked[i] && dist[i] <= r2)
+        values[i] = labels[i];
+    }
+  }
+
+  // Erases solid voxels within the given distance of empty voxels
+  void erode(float radius)
+  {
+    transform(false);
+
+    const float r2 = radius * radius;
+    for (size_t i = 0u; i < values.size(); ++i)
+    {
+      if (values[i] != 0u && dist[i] <= r2)
+        values[i] = 0u;
+    }
+  }
+
+  // Computes the squared distance of each voxel to the closest solid (or
+  // empty) voxel of the region. Blocked voxels are neither. Voxels outside of
+  // the region are not considered, so solid voxels at the border of the shape
+  // are not eroded.
+  void transform(bool solid_sites)
+  {
+    for (uint32_t axis = 0u; axis < 3u; ++axis)
+    {
+      pass_task_t task;
+      io_init_scheduler_task(&task, axis < 2u ? dim.z : dim.y,
+                             pass_task_t::execute);
+      task.morphology = this;
+      task.axis = axis;
+      task.solid_sites = solid_sites;
+
+      io_base->scheduler_enqueue_task(&task);
+      io_base->scheduler_wait_for_task(&task);
+    }
+  }
+
+  // Transforms one slab of lines along the axis of the pass per workload
+  struct pass_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      const auto task = (const pass_task_t*)task_;
+      auto& m = *task->morphology;
+      const glm::ivec3 dim = m.dim;
+
+      const int32_t n = dim[task->axis];
+      std::vector<float> f(n), d(n), z(n + 1);
+      std::vector<uint8_t> l(n), out_l(n);
+      std::vector<int32_t> v(n);
+
+      for (uint32_t w = range.x; w < range.y; ++w)
+      {
+        if (task->axis == 0u)
+        {
+          for (int32_t y = 0; y < dim.y; ++y)
+            m.scan_line(m.calc_index(0, y, w), task->solid_sites);
+          continue;
+        }
+
+        // Lines along y (per z slab) or z (per y row)
+        const int32_t num_lines = dim.x;
+        const size_t stride = task->axis == 1u ? dim.x : (size_t)dim.x * dim.y;
+
+        for (int32_t x = 0; x < num_lines; ++x)
+        {
+          const size_t start =
+              task->axis == 1u ? m.calc_index(x, 0, w) : m.calc_index(x, w, 0);
+
+          bool has_sites = false;
+          for (int32_t i = 0; i < n; ++i)
+          {
+            f[i] = m.dist[start + i * stride];
+            l[i] = m.labels[start + i * stride];
+            has_sites |= f[i] < inf;
+          }
+
+          if (!has_sites)
+            continue;
+
+          lower_envelope(n, f.data(), l.data(), d.data(), out_l.data(),
+                         v.data(), z.data());
+
+          for (int32_t i = 0; i < n; ++i)
+          {
+            m.dist[start + i * stride] = d[i];
+            m.labels[start + i * stride] = out_l[i];
+          }
+        }
+      }
+    }
+
+    morphology_t* morphology;
+    uint32_t axis;
+    bool solid_sites;
+  };
+
+  // First pass: distance to the closest site along x via a forward and a
+  // backward scan
+  void scan_line(size_t start, bool solid_sites)
+  {
+    const uint8_t* val = &values[start];
+    const uint8_t* b = &blocked[start];
+    float* d = &dist[start];
+    uint8_t* l = &labels[start];
+
+    const auto is_site = [&](int32_t x) -> bool {
+      return !b[x] && (val[x] != 0u) == solid_sites;
+    };
+
+    int32_t last = -1;
+    for (int32_t x = 0; x < dim.x; ++x)
+    {
+      if (is_site(x))
+        last = x;
+
+      if (last >= 0)
+      {
+        d[x] = (float)((x - last) * (x - last));
+        l[x] = val[last];
+      }
+      else
+        d[x] = inf;
+    }
+
+    last = -1;
+    for (int32_t x = dim.x - 1; x >= 0; --x)
+    {
+      if (is_site(x))
+        last = x;
+
+      if (last >= 0)
+      {
+        const float dl = (float)((last - x) * (last - x));
+        if (dl < d[x])
+        {
+          d[x] = dl;
+          l[x] = val[last];
+        }
+      }
+    }
+  }
+
+  // Squared distance transform of a sampled function along one line. Sites
+  // with infinite values are skipped.
+  static void lower_envelope(int32_t n, const float* f, const uint8_t* l,
+                             float* d, uint8_t* out_l, int32_t* v, float* z)
+  {
+    int32_t k = -1;
+    for (int32_t q = 0; q < n; ++q)
+    {
+      if (f[q] >= inf)
+        continue;
+
+      // Intersection with the parabola on top of the envelope
+      float s = -inf;
+      while (k >= 0)
+      {
+        const int32_t p = v[k];
+        s = ((f[q] + (float)(q * q)) - (f[p] + (float)(p * p))) /
+            (float)(2 * (q - p));
+        if (s > z[k])
+          break;
+
+        s = -inf;
+        --k;
+      }
+
+      ++k;
+      v[k] = q;
+      z[k] = s;
+    }
+    z[k + 1] = inf;
+
+    k = 0;
+    for (int32_t q = 0; q < n; ++q)
+    {
+      while (z[k + 1] < (float)q)
+        ++k;
+
+      const int32_t p = v[k];
+      d[q] = (float)((q - p) * (q - p)) + f[p];
+      out_l[q] = l[p];
+    }
+  }
+
+  glm::ivec3 region_min{0}, dim{0};
+  std::vector<uint8_t> values, blocked, labels;
+  std::vector<float> dist;
+};
+
+//----------------------------------------------------------------------------//
+static morphology_t morphology;
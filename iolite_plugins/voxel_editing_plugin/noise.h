@@ -0,0 +1,176 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+
+//----------------------------------------------------------------------------//
+enum noise_mode_
+{
+  noise_mode_fill,  // Fills empty voxels where the noise exceeds the threshold
+  noise_mode_erode, // Erases solid voxels where the noise is below it
+  noise_mode_paint  // Recolors solid voxels
+};
+using noise_mode_t = int32_t;
+
+//----------------------------------------------------------------------------//
+struct noise_params_t
+{
+  noise_mode_t mode{noise_mode_fill};
+  float threshold{0.5f};
+
+  float scale{16.0f}; // Size of the largest features in voxels
+  int32_t octaves{4};
+  float lacunarity{2.0f};
+  float gain{0.5f};
+  uint32_t seed{0u};
+};
+
+//----------------------------------------------------------------------------//
+// Gradient noise evaluated for eight positions at once. The lattice gradients
+// are derived from a hash of the lattice coordinates, so no permutation
+// tables are needed and the result only depends on the seed.
+namespace noise
+{
+
+//----------------------------------------------------------------------------//
+inline auto fade(__m256 t) -> __m256
+{
+  // 6t^5 - 15t^4 + 10t^3
+  const __m256 p = _mm256_fmadd_ps(
+      t,
+      _mm256_fmadd_ps(t, _mm256_set1_ps(6.0f), _mm256_set1_ps(-15.0f)),
+      _mm256_set1_ps(10.0f));
+  return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), p);
+}
+
+//----------------------------------------------------------------------------//
+inline auto lerp(__m256 a, __m256 b, __m256 t) -> __m256
+{
+  return _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a);
+}
+
+//----------------------------------------------------------------------------//
+// Dot product of the offset with one of the 12 edge gradients of the cube
+// ("Improved Noise", Perlin 2002), selected by the low four bits of the hash
+inline auto grad(__m256i h, __m256 x, __m256 y, __m256 z) -> __m256
+{
+  h = _mm256_and_si256(h, _mm256_set1_epi32(15));
+
+  const __m256 lt8 =
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+  const __m256 lt4 =
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+  const __m256 is_12_or_14 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+      _mm256_and_si256(h, _mm256_set1_epi32(13)), _mm256_set1_epi32(12)));
+
+  __m256 u = _mm256_blendv_ps(y, x, lt8);
+  __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, is_12_or_14), y, lt4);
+
+  // Flip the signs using bits 0 and 1
+  u = _mm256_xor_ps(u, _mm256_castsi256_ps(_mm256_slli_epi32(h, 31)));
+  v = _mm256_xor_ps(
+      v, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_srli_epi32(h, 1), 31)));
+
+  return _mm256_add_ps(u, v);
+}
+
+//----------------------------------------------------------------------------//
+// Returns gradient noise in [-1, 1]
+inline auto perlin(__m256 x, __m256 y, __m256 z, uint32_t seed) -> __m256
+{
+  const __m256 x0 = _mm256_floor_ps(x), y0 = _mm256_floor_ps(y),
+               z0 = _mm256_floor_ps(z);
+  const __m256 fx = _mm256_sub_ps(x, x0), fy = _mm256_sub_ps(y, y0),
+               fz = _mm256_sub_ps(z, z0);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 gx = _mm256_sub_ps(fx, one), gy = _mm256_sub_ps(fy, one),
+               gz = _mm256_sub_ps(fz, one);
+
+  // Hash the lattice coordinates as "x * p0 ^ y * p1 ^ z * p2 ^ seed"
+  const __m256i p0 = _mm256_set1_epi32((int32_t)0x8DA6B343u),
+                p1 = _mm256_set1_epi32((int32_t)0xD8163841u),
+                p2 = _mm256_set1_epi32((int32_t)0xCB1AB31Fu);
+  const __m256i s = _mm256_set1_epi32((int32_t)seed);
+  const __m256i hx0 = _mm256_mullo_epi32(_mm256_cvtps_epi32(x0), p0);
+  const __m256i hy0 = _mm256_mullo_epi32(_mm256_cvtps_epi32(y0), p1);
+  const __m256i hz = _mm256_mullo_epi32(_mm256_cvtps_epi32(z0), p2);
+  const __m256i hx1 = _mm256_add_epi32(hx0, p0);
+  const __m256i hy1 = _mm256_add_epi32(hy0, p1);
+  const __m256i hz0 = _mm256_xor_si256(hz, s);
+  const __m256i hz1 = _mm256_xor_si256(_mm256_add_epi32(hz, p2), s);
+
+  const auto corner = [](__m256i hx, __m256i hy, __m256i hz, __m256 x,
+                         __m256 y, __m256 z) -> __m256 {
+    return grad(common::hash(_mm256_xor_si256(_mm256_xor_si256(hx, hy), hz)),
+                x, y, z);
+  };
+
+  const __m256 u = fade(fx), v = fade(fy), w = fade(fz);
+
+  const __m256 x00 = lerp(corner(hx0, hy0, hz0, fx, fy, fz),
+                          corner(hx1, hy0, hz0, gx, fy, fz), u);
+  const __m256 x10 = lerp(corner(hx0, hy1, hz0, fx, gy, fz),
+                          corner(hx1, hy1, hz0, gx, gy, fz), u);
+  const __m256 x01 = lerp(corner(hx0, hy0, hz1, fx, fy, gz),
+                          corner(hx1, hy0, hz1, gx, fy, gz), u);
+  const __m256 x11 = lerp(corner(hx0, hy1, hz1, fx, gy, gz),
+                          corner(hx1, hy1, hz1, gx, gy, gz), u);
+
+  return lerp(lerp(x00, x10, v), lerp(x01, x11, v), w);
+}
+
+//----------------------------------------------------------------------------//
+// Fractal Brownian motion summing the given number of octaves of gradient
+// noise. The position is expected in units of the largest features. Returns
+// values in [0, 1].
+inline auto fbm(__m256 x, __m256 y, __m256 z, const noise_params_t& params)
+    -> __m256
+{
+  __m256 sum = _mm256_setzero_ps();
+  float frequency = 1.0f, amplitude = 1.0f, total_amplitude = 0.0f;
+
+  for (int32_t i = 0; i < params.octaves; ++i)
+  {
+    const __m256 f = _mm256_set1_ps(frequency);
+    sum = _mm256_fmadd_ps(
+        perlin(_mm256_mul_ps(x, f), _mm256_mul_ps(y, f), _mm256_mul_ps(z, f),
+               common::hash(params.seed + i)),
+        _mm256_set1_ps(amplitude), sum);
+
+    total_amplitude += amplitude;
+    frequency *= params.lacunarity;
+    amplitude *= params.gain;
+  }
+
+  if (total_amplitude <= 0.0f)
+    return _mm256_set1_ps(0.5f);
+
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 value =
+      _mm256_fmadd_ps(sum, _mm256_set1_ps(0.5f / total_amplitude), half);
+  return _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()),
+                       _mm256_set1_ps(1.0f));
+}
+
+} // namespace noise
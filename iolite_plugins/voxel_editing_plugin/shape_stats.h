@@ -0,0 +1,282 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+
+// STL
+#include <atomic>
+
+//----------------------------------------------------------------------------//
+// Statistics about how dense and compressible the voxel data of a shape is.
+struct shape_stats_t
+{
+  static constexpr int32_t brick_size = 32;
+
+  glm::ivec3 dim{0};
+  uint64_t num_voxels{0u};
+  uint64_t num_solid{0u};
+  uint64_t num_surface{0u}; // Solid voxels with at least one empty neighbor
+
+  // Runs of identical values along x, split after 255 voxels so each run can
+  // be stored as a (length, value) byte pair
+  uint64_t num_runs{0u};
+  uint32_t max_run_length{0u};
+
+  // Bricks of 32^3 voxels (clipped to the bounds of the shape)
+  uint32_t num_bricks{0u};
+  uint32_t num_empty_bricks{0u};
+  uint32_t num_full_bricks{0u};
+
+  uint32_t num_used_palette_indices{0u};
+  uint32_t palette_histogram[255];
+
+  inline auto calc_raw_size() const -> uint64_t { return num_voxels; }
+  inline auto calc_rle_size() const -> uint64_t { return num_runs * 2u; }
+};
+
+//----------------------------------------------------------------------------//
+// Computes the statistics of a shape on the worker threads. The voxel data is
+// copied when the analysis starts, so the shape can be edited meanwhile.
+// "update" is meant to be called once per frame and never blocks.
+struct shape_analysis_t
+{
+  // Requests a (re)analysis of the given shape. If an analysis is still
+  // running, the request is deferred until it completes.
+  void request(io_ref_t shape)
+  {
+    requested_shape = shape;
+    has_request = true;
+  }
+
+  // Polls the running analysis and starts pending requests. Returns true if
+  // new statistics became available.
+  auto update() -> bool
+  {
+    bool completed = false;
+    if (is_running && io_base->scheduler_is_task_completed(&task))
+    {
+      is_running = false;
+      reduce();
+      completed = true;
+    }
+
+    if (!is_running && has_request)
+    {
+      has_request = false;
+      start(requested_shape);
+    }
+
+    return completed;
+  }
+
+  // Blocks until the running analysis (if any) completed
+  void wait()
+  {
+    if (!is_running)
+      return;
+
+    io_base->scheduler_wait_for_task(&task);
+    is_running = false;
+    reduce();
+  }
+
+  inline auto is_busy() const -> bool { return is_running || has_request; }
+
+  // Returns true if the statistics of the given shape are available
+  inline auto has_stats_for(io_ref_t shape) const -> bool
+  {
+    return has_stats && io_ref_is_equal(stats_shape, shape);
+  }
+
+  inline auto get_stats() const -> const shape_stats_t& { return stats; }
+
+private:
+  // Partial results of a single slice along z
+  struct slice_t
+  {
+    uint64_t num_solid;
+    uint64_t num_surface;
+    uint64_t num_runs;
+    uint32_t max_run_length;
+    uint32_t palette_histogram[255];
+  };
+
+  struct analysis_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      const auto task = (analysis_task_t*)task_;
+      auto& a = *task->analysis;
+      const glm::ivec3 dim = a.dim;
+      const int32_t slice_size = dim.x * dim.y;
+      const glm::ivec3 num_bricks =
+          (dim + shape_stats_t::brick_size - 1) / shape_stats_t::brick_size;
+
+      // Number of solid voxels per brick of the current brick layer
+      std::vector<uint32_t> brick_counts(num_bricks.x * num_bricks.y);
+
+      for (uint32_t z = range.x; z < range.y; ++z)
+      {
+        slice_t& s = a.slices[z];
+        s = {};
+        std::fill(brick_counts.begin(), brick_counts.end(), 0u);
+
+        const uint8_t* slice = a.data.data() + (size_t)z * slice_size;
+        for (int32_t y = 0; y < dim.y; ++y)
+        {
+          const uint8_t* row = slice + y * dim.x;
+          const bool border_yz = y == 0 || y == dim.y - 1 || z == 0u ||
+                                 z == (uint32_t)dim.z - 1u;
+
+          uint32_t run_length = 0u, same_length = 0u;
+          for (int32_t x = 0; x < dim.x; ++x)
+          {
+            const uint8_t v = row[x];
+
+            if (x > 0 && v == row[x - 1])
+              ++same_length;
+            else
+              same_length = 1u;
+            s.max_run_length = glm::max(s.max_run_length, same_length);
+
+            if (same_length == 1u || run_length == 255u)
+            {
+              ++s.num_runs;
+              run_length = 0u;
+            }
+            ++run_length;
+
+            if (v == 0u)
+              continue;
+
+            ++s.num_solid;
+            ++s.palette_histogram[v - 1u];
+            ++brick_counts[x / shape_stats_t::brick_size +
+                           y / shape_stats_t::brick_size * num_bricks.x];
+
+            // Voxels at the bounds of the shape are always exposed
+            const bool exposed =
+                border_yz || x == 0 || x == dim.x - 1 || row[x - 1] == 0u ||
+                row[x + 1] == 0u || row[x - dim.x] == 0u ||
+                row[x + dim.x] == 0u || row[x - slice_size] == 0u ||
+                row[x + slice_size] == 0u;
+            s.num_surface += exposed;
+          }
+        }
+
+        const uint32_t layer = z / shape_stats_t::brick_size;
+        for (uint32_t i = 0u; i < brick_counts.size(); ++i)
+        {
+          if (brick_counts[i])
+            std::atomic_ref<uint32_t>(
+                a.brick_counts[i + layer * brick_counts.size()])
+                .fetch_add(brick_counts[i], std::memory_order_relaxed);
+        }
+      }
+    }
+
+    shape_analysis_t* analysis;
+  };
+
+  void start(io_ref_t shape)
+  {
+    if (!io_component_voxel_shape->base.is_alive(shape))
+      return;
+
+    const uint8_t* voxel_data = io_component_voxel_shape->get_voxel_data(shape);
+    dim = glm::ivec3(io_cvt(io_component_voxel_shape->get_dim(shape)));
+    data.assign(voxel_data, voxel_data + (size_t)dim.x * dim.y * dim.z);
+
+    const glm::ivec3 num_bricks =
+        (dim + shape_stats_t::brick_size - 1) / shape_stats_t::brick_size;
+    brick_counts.assign(num_bricks.x * num_bricks.y * num_bricks.z, 0u);
+    slices.resize(dim.z);
+
+    io_init_scheduler_task(&task, dim.z, analysis_task_t::execute);
+    task.analysis = this;
+    io_base->scheduler_enqueue_task(&task);
+
+    analyzed_shape = shape;
+    is_running = true;
+  }
+
+  // Merges the partial results of the slices
+  void reduce()
+  {
+    stats = {};
+    stats.dim = dim;
+    stats.num_voxels = data.size();
+
+    for (const auto& s : slices)
+    {
+      stats.num_solid += s.num_solid;
+      stats.num_surface += s.num_surface;
+      stats.num_runs += s.num_runs;
+      stats.max_run_length = glm::max(stats.max_run_length, s.max_run_length);
+      for (uint32_t i = 0u; i < 255u; ++i)
+        stats.palette_histogram[i] += s.palette_histogram[i];
+    }
+
+    for (uint32_t i = 0u; i < 255u; ++i)
+      stats.num_used_palette_indices += stats.palette_histogram[i] != 0u;
+
+    const int32_t bs = shape_stats_t::brick_size;
+    const glm::ivec3 num_bricks = (dim + bs - 1) / bs;
+    uint32_t i = 0u;
+    for (int32_t z = 0; z < num_bricks.z; ++z)
+      for (int32_t y = 0; y < num_bricks.y; ++y)
+        for (int32_t x = 0; x < num_bricks.x; ++x, ++i)
+        {
+          const glm::ivec3 min_coord = glm::ivec3(x, y, z) * bs;
+          const glm::ivec3 extent = glm::min(min_coord + bs, dim) - min_coord;
+
+          ++stats.num_bricks;
+          stats.num_empty_bricks += brick_counts[i] == 0u;
+          stats.num_full_bricks += brick_counts[i] ==
+                                   (uint32_t)(extent.x * extent.y * extent.z);
+        }
+
+    stats_shape = analyzed_shape;
+    has_stats = true;
+  }
+
+  analysis_task_t task;
+  std::vector<uint8_t> data;
+  glm::ivec3 dim{0};
+  std::vector<slice_t> slices;
+  std::vector<uint32_t> brick_counts;
+  io_ref_t analyzed_shape{};
+  bool is_running{false};
+
+  io_ref_t requested_shape{};
+  bool has_request{false};
+
+  shape_stats_t stats;
+  io_ref_t stats_shape{};
+  bool has_stats{false};
+};
+
+//----------------------------------------------------------------------------//
+static shape_analysis_t shape_analysis;
@@ -26,6 +26,7 @@
 #include "iolite_api.h"
 
 // STL
+#include <bit>
 #include <chrono>
 
 //----------------------------------------------------------------------------//
@@ -37,58 +38,345 @@ enum remove_mode_
 using remove_mode_t = uint8_t;
 
 //----------------------------------------------------------------------------//
-template <bool UseMortonEncoding = false> struct sparse_occupancy_mask_t
+// Sparse occupancy mask for a global grid of 256^3 voxels. The grid is
+// quantized to 8^3 cells of 32^3 voxels each, which are allocated on demand.
+// Cells are stored as 8^3 bricks and each brick packs 4^3 voxels into a single
+// 64-bit word:
+//   bit = x + y * 4 + z * 16
+//----------------------------------------------------------------------------//
+struct sparse_occupancy_mask_t
 {
-  struct mask_t
+  static constexpr uint32_t num_cells = 512u;
+  static constexpr uint32_t num_bricks_per_cell = 512u;
+
+  // Bits of the brick word located on the six boundary planes of the brick
+  static constexpr uint64_t plane_x0 = 0x1111111111111111ull;
+  static constexpr uint64_t plane_x3 = plane_x0 << 3u;
+  static constexpr uint64_t plane_y0 = 0x000F000F000F000Full;
+  static constexpr uint64_t plane_y3 = plane_y0 << 12u;
+  static constexpr uint64_t plane_z0 = 0xFFFFull;
+  static constexpr uint64_t plane_z3 = plane_z0 << 48u;
+
+  // Coordinates outside of the grid are rejected: "set" reports no change and
+  // "get" reports empty
+  template <typename T>
+  inline static auto is_coord_valid(const T& coord) -> bool
   {
-    inline mask_t() { data.resize(32768u); } // 32^3
-
-    std::vector<bool> data;
-  };
+    return (uint32_t)coord.x < 256u && (uint32_t)coord.y < 256u &&
+           (uint32_t)coord.z < 256u;
+  }
 
   template <typename T> inline auto set(const T& coord, bool occupied) -> bool
   {
-    auto* mask = get_mask(coord);
-    const auto mask_index = calc_mask_index(coord);
+    if (!is_coord_valid(coord))
+      return false;
 
-    const bool was_occupied = mask->data[mask_index];
-    mask->data[mask_index] = occupied;
+    const auto cell_index = calc_cell_index(coord);
+    if (cell_offsets[cell_index] == 0u)
+    {
+      if (!occupied)
+        return false;
+      allocate_cell(cell_index);
+    }
+
+    uint64_t& brick =
+        bricks[cell_offsets[cell_index] + calc_brick_index(coord)];
+    const uint64_t bit = 1ull << calc_bit_index(coord);
+
+    const bool was_occupied = (brick & bit) != 0u;
+    brick = occupied ? (brick | bit) : (brick & ~bit);
 
     return was_occupied != occupied;
   };
 
-  template <typename T> inline auto get(const T& coord) -> bool
+  template <typename T> inline auto get(const T& coord) const -> bool
   {
-    auto* mask = get_mask<T, false>(coord);
-    if (nullptr == mask)
+    if (bricks.empty() || !is_coord_valid(coord))
       return false;
-    return mask->data[calc_mask_index(coord)];
+
+    // Unallocated cells point to the empty cell at offset zero
+    const uint64_t brick = bricks[cell_offsets[calc_cell_index(coord)] +
+                                  calc_brick_index(coord)];
+    return (brick >> calc_bit_index(coord)) & 1u;
   };
 
-  inline auto clear() -> void { cells.clear(); }
+  // Batched version of "get" for packed coordinates (see
+  // "sparse_volume_t::pack"). Writes 0 or 1 for each of the coordinates to
+  // "results". "Stride" is the distance between two coordinates in multiples
+  // of 32 bits.
+  template <uint32_t Stride = 1u>
+  inline void get_batch(const uint32_t* packed_coords, uint32_t num_coords,
+                        uint8_t* results) const
+  {
+    if (bricks.empty())
+    {
+      memset(results, 0, num_coords);
+      return;
+    }
 
-private:
-  template <typename T, bool Create = true>
-  inline auto get_mask(const T& coord) -> mask_t*
+    uint32_t i = 0u;
+    for (; i + 8u <= num_coords; i += 8u)
+    {
+      __m256i cell, brick, bit;
+      calc_indices_8x(load_8x<Stride>(packed_coords + i * Stride), cell, brick,
+                      bit);
+
+      const __m256i word_index = _mm256_add_epi32(
+          _mm256_i32gather_epi32((const int*)cell_offsets, cell, 4), brick);
+
+      // Gather the words and move the bits in question to the sign bit
+      const __m256i shift = _mm256_sub_epi32(_mm256_set1_epi32(63), bit);
+      const __m256i words_lo = _mm256_i32gather_epi64(
+          (const long long*)bricks.data(), _mm256_castsi256_si128(word_index),
+          8);
+      const __m256i words_hi = _mm256_i32gather_epi64(
+          (const long long*)bricks.data(),
+          _mm256_extracti128_si256(word_index, 1), 8);
+      const __m256i bits_lo = _mm256_sllv_epi64(
+          words_lo, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shift)));
+      const __m256i bits_hi = _mm256_sllv_epi64(
+          words_hi, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shift, 1)));
+
+      const uint32_t mask =
+          _mm256_movemask_pd(_mm256_castsi256_pd(bits_lo)) |
+          (_mm256_movemask_pd(_mm256_castsi256_pd(bits_hi)) << 4u);
+
+      // Expand to one byte per coordinate
+      const uint64_t bytes = _pdep_u64(mask, 0x0101010101010101ull);
+      memcpy(&results[i], &bytes, sizeof(bytes));
+    }
+
+    for (; i < num_coords; ++i)
+      results[i] = get(unpack_coord(packed_coords[i * Stride]));
+  }
+
+  // Batched version of "set" for packed coordinates (see
+  // "sparse_volume_t::pack"). Marks all coordinates as occupied and returns
+  // the number of voxels which have not been occupied before.
+  template <uint32_t Stride = 1u>
+  inline auto set_batch(const uint32_t* packed_coords, uint32_t num_coords)
+      -> uint32_t
   {
-    const auto cell_index = calc_cell_index(coord);
-    if constexpr (Create)
+    uint32_t num_changed = 0u;
+
+    alignas(32) uint32_t cells[8], bricks_idx[8], bits[8];
+
+    uint32_t i = 0u;
+    for (; i + 8u <= num_coords; i += 8u)
     {
-      if (cell_index >= cells.size())
-        cells.resize(cell_index + 1u);
+      __m256i cell, brick, bit;
+      calc_indices_8x(load_8x<Stride>(packed_coords + i * Stride), cell, brick,
+                      bit);
+
+      _mm256_store_si256((__m256i*)cells, cell);
+      _mm256_store_si256((__m256i*)bricks_idx, brick);
+      _mm256_store_si256((__m256i*)bits, bit);
+
+      for (uint32_t j = 0u; j < 8u; ++j)
+      {
+        if (cell_offsets[cells[j]] == 0u)
+          allocate_cell(cells[j]);
+
+        uint64_t& word = bricks[cell_offsets[cells[j]] + bricks_idx[j]];
+        const uint64_t mask = 1ull << bits[j];
+        num_changed += (word & mask) == 0u;
+        word |= mask;
+      }
     }
-    else
+
+    for (; i < num_coords; ++i)
+      num_changed += set(unpack_coord(packed_coords[i * Stride]), true);
+
+    return num_changed;
+  }
+
+  // Marks all voxels of the given brick mask as occupied. The brick
+  // coordinate is in [0, 64)^3. Returns the bits which have not been occupied
+  // before.
+  inline auto or_brick(uint32_t bx, uint32_t by, uint32_t bz, uint64_t mask)
+      -> uint64_t
+  {
+    const uint32_t cell_index =
+        (bx >> 3u) + ((by >> 3u) << 3u) + ((bz >> 3u) << 6u);
+    if (cell_offsets[cell_index] == 0u)
+      allocate_cell(cell_index);
+
+    uint64_t& brick = bricks[cell_offsets[cell_index] + (bx & 7u) +
+                             ((by & 7u) << 3u) + ((bz & 7u) << 6u)];
+    const uint64_t added = mask & ~brick;
+    brick |= mask;
+
+    return added;
+  }
+
+  // Returns the number of occupied voxels.
+  inline auto count() const -> uint32_t
+  {
+    // Nibble lookup table based population count
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2,
+                                         3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2,
+                                         2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0u; i < bricks.size(); i += 4u)
     {
-      if (cell_index >= cells.size())
-        return nullptr;
+      const __m256i v = _mm256_loadu_si256((const __m256i*)&bricks[i]);
+      const __m256i lo = _mm256_and_si256(v, low_mask);
+      const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+      const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                                          _mm256_shuffle_epi8(lut, hi));
+      acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
     }
-    return &cells[cell_index];
+
+    alignas(32) uint64_t sums[4];
+    _mm256_store_si256((__m256i*)sums, acc);
+    return uint32_t(sums[0] + sums[1] + sums[2] + sums[3]);
+  }
+
+  // Returns the brick with the given brick coordinate (in [0, 64)^3). Bricks
+  // outside the grid are reported as empty.
+  inline auto get_brick(int32_t bx, int32_t by, int32_t bz) const -> uint64_t
+  {
+    if ((uint32_t)bx >= 64u || (uint32_t)by >= 64u || (uint32_t)bz >= 64u ||
+        bricks.empty())
+      return 0u;
+
+    const uint32_t cell_index = (bx >> 3u) + ((by >> 3u) << 3u) +
+                                ((bz >> 3u) << 6u);
+    const uint32_t brick_index =
+        (bx & 7u) + ((by & 7u) << 3u) + ((bz & 7u) << 6u);
+    return bricks[cell_offsets[cell_index] + brick_index];
+  }
+
+  // Calculates the exposed faces of all voxels of the given brick using the
+  // six neighboring bricks. Each mask has a bit set for each voxel with an
+  // exposed face. The masks are indexed via "io_box_face_index".
+  inline void calc_exposed_faces(int32_t bx, int32_t by, int32_t bz,
+                                 uint64_t faces[6]) const
+  {
+    const uint64_t b = get_brick(bx, by, bz);
+
+    // Occupancy of the neighbor in the given direction for each voxel
+    const uint64_t px = ((b >> 1u) & ~plane_x3) |
+                        ((get_brick(bx + 1, by, bz) & plane_x0) << 3u);
+    const uint64_t nx = ((b << 1u) & ~plane_x0) |
+                        ((get_brick(bx - 1, by, bz) & plane_x3) >> 3u);
+    const uint64_t py = ((b >> 4u) & ~plane_y3) |
+                        ((get_brick(bx, by + 1, bz) & plane_y0) << 12u);
+    const uint64_t ny = ((b << 4u) & ~plane_y0) |
+                        ((get_brick(bx, by - 1, bz) & plane_y3) >> 12u);
+    const uint64_t pz =
+        (b >> 16u) | ((get_brick(bx, by, bz + 1) & plane_z0) << 48u);
+    const uint64_t nz =
+        (b << 16u) | ((get_brick(bx, by, bz - 1) & plane_z3) >> 48u);
+
+    faces[io_box_face_index_front] = b & ~pz;
+    faces[io_box_face_index_back] = b & ~nz;
+    faces[io_box_face_index_top] = b & ~py;
+    faces[io_box_face_index_bottom] = b & ~ny;
+    faces[io_box_face_index_left] = b & ~nx;
+    faces[io_box_face_index_right] = b & ~px;
+  }
+
+  // Extracts the face flags for a single voxel from the masks calculated via
+  // "calc_exposed_faces".
+  inline static auto extract_face_flags(const uint64_t faces[6],
+                                        uint32_t bit_index) -> uint8_t
+  {
+    uint8_t flags = 0u;
+    for (uint32_t i = 0u; i < 6u; ++i)
+      flags |= uint8_t((faces[i] >> bit_index) & 1u) << i;
+    return flags;
+  }
+
+  // Returns the exposed faces of the voxel at the given coordinate.
+  template <typename T> inline auto get_face_flags(const T& coord) const
+  {
+    uint64_t faces[6];
+    calc_exposed_faces((uint32_t)coord.x >> 2u, (uint32_t)coord.y >> 2u,
+                       (uint32_t)coord.z >> 2u, faces);
+    return extract_face_flags(faces, calc_bit_index(coord));
+  }
+
+  inline auto clear() -> void
+  {
+    bricks.clear();
+    memset(cell_offsets, 0, sizeof(cell_offsets));
+  }
+
+  template <typename T>
+  inline static auto calc_bit_index(const T& coord) -> uint32_t
+  {
+    return ((uint32_t)coord.x & 3u) | (((uint32_t)coord.y & 3u) << 2u) |
+           (((uint32_t)coord.z & 3u) << 4u);
+  }
+
+private:
+  inline void allocate_cell(uint32_t cell_index)
+  {
+    // The first cell is reserved as the empty cell all unallocated cells
+    // point to
+    if (bricks.empty())
+      bricks.resize(num_bricks_per_cell);
+
+    cell_offsets[cell_index] = (uint32_t)bricks.size();
+    bricks.resize(bricks.size() + num_bricks_per_cell);
+  }
+
+  inline static auto unpack_coord(uint32_t packed) -> io_uvec3_t
+  {
+    return {packed & 0xFFu, (packed >> 8u) & 0xFFu, (packed >> 16u) & 0xFFu};
+  }
+
+  template <uint32_t Stride>
+  inline static auto load_8x(const uint32_t* packed_coords) -> __m256i
+  {
+    if constexpr (Stride == 1u)
+      return _mm256_loadu_si256((const __m256i*)packed_coords);
+    else
+      return _mm256_i32gather_epi32(
+          (const int*)packed_coords,
+          _mm256_setr_epi32(0, Stride, 2 * Stride, 3 * Stride, 4 * Stride,
+                            5 * Stride, 6 * Stride, 7 * Stride),
+          4);
+  }
+
+  inline static void calc_indices_8x(__m256i packed, __m256i& cell,
+                                     __m256i& brick, __m256i& bit)
+  {
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i x = _mm256_and_si256(packed, byte_mask);
+    const __m256i y = _mm256_and_si256(_mm256_srli_epi32(packed, 8), byte_mask);
+    const __m256i z =
+        _mm256_and_si256(_mm256_srli_epi32(packed, 16), byte_mask);
+
+    cell = _mm256_or_si256(
+        _mm256_or_si256(_mm256_srli_epi32(x, 5),
+                        _mm256_slli_epi32(_mm256_srli_epi32(y, 5), 3)),
+        _mm256_slli_epi32(_mm256_srli_epi32(z, 5), 6));
+
+    const __m256i mask_7 = _mm256_set1_epi32(7);
+    brick = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(x, 2), mask_7),
+            _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(y, 2), mask_7),
+                              3)),
+        _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(z, 2), mask_7),
+                          6));
+
+    const __m256i mask_3 = _mm256_set1_epi32(3);
+    bit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(x, mask_3),
+                        _mm256_slli_epi32(_mm256_and_si256(y, mask_3), 2)),
+        _mm256_slli_epi32(_mm256_and_si256(z, mask_3), 4));
   }
 
   template <typename T>
   inline static auto calc_cell_index(const T& coord) -> uint32_t
   {
-    // Quantize to 32^3 cells
+    // Quantize to 32^3 cells. Only valid for coordinates inside of the grid
+    // (see "is_coord_valid")
     const io_uvec3_t coord_quant = {(uint32_t)coord.x >> 5u,
                                     (uint32_t)coord.y >> 5u,
                                     (uint32_t)coord.z >> 5u};
@@ -97,24 +385,270 @@ private:
   }
 
   template <typename T>
-  inline static auto calc_mask_index(const T& coord) -> uint32_t
+  inline static auto calc_brick_index(const T& coord) -> uint32_t
   {
-    if constexpr (UseMortonEncoding)
+    // Quantize to 4^3 bricks and wrap in a single 32^3 cell
+    return (((uint32_t)coord.x >> 2u) & 7u) |
+           ((((uint32_t)coord.y >> 2u) & 7u) << 3u) |
+           ((((uint32_t)coord.z >> 2u) & 7u) << 6u);
+  }
+
+  uint32_t cell_offsets[num_cells] = {};
+  std::vector<uint64_t> bricks;
+};
+
+//----------------------------------------------------------------------------//
+// Open addressing hash index (linear probing) mapping packed voxel
+// coordinates (see "sparse_volume_t::pack") to entry indices.
+//----------------------------------------------------------------------------//
+struct sparse_volume_index_t
+{
+  static constexpr uint32_t invalid = 0xFFFFFFFFu;
+
+  struct slot_t
+  {
+    uint32_t key;
+    uint32_t value;
+  };
+
+  // Returns the value for the given key or "invalid" if the key does not
+  // exist.
+  inline auto find(uint32_t key) const -> uint32_t
+  {
+    if (slots.empty())
+      return invalid;
+
+    for (uint32_t i = hash(key);; i = (i + 1u) & mask)
     {
-      return morton::encode_5b(
-          io_uvec3_t{(uint32_t)coord.x, (uint32_t)coord.y, (uint32_t)coord.z});
+      const auto& slot = slots[i];
+      if (slot.key == key)
+        return slot.value;
+      if (slot.key == invalid)
+        return invalid;
     }
-    else
+  }
+
+  // Inserts or updates the value for the given key.
+  inline void insert(uint32_t key, uint32_t value)
+  {
+    // Keep the load factor below 0.5
+    if ((size + 1u) * 2u > (uint32_t)slots.size())
+      rehash(glm::max((uint32_t)slots.size() * 2u, 64u));
+
+    for (uint32_t i = hash(key);; i = (i + 1u) & mask)
     {
-      // Wrap in a single 32^3 cell
-      const io_uvec3_t coord_mask = {(uint32_t)coord.x & 31u,
-                                     (uint32_t)coord.y & 31u,
-                                     (uint32_t)coord.z & 31u};
-      return coord_mask.x + (coord_mask.y << 5u) + (coord_mask.z << 10u);
+      auto& slot = slots[i];
+      if (slot.key == key)
+      {
+        slot.value = value;
+        return;
+      }
+      if (slot.key == invalid)
+      {
+        slot = {key, value};
+        ++size;
+        return;
+      }
     }
   }
 
-  std::vector<mask_t> cells;
+  // Removes the given key (if it exists).
+  inline void erase(uint32_t key)
+  {
+    if (slots.empty())
+      return;
+
+    uint32_t i = hash(key);
+    while (slots[i].key != key)
+    {
+      if (slots[i].key == invalid)
+        return;
+      i = (i + 1u) & mask;
+    }
+
+    // Backward shift deletion, so we don't need tombstones
+    for (uint32_t j = (i + 1u) & mask; slots[j].key != invalid;
+         j = (j + 1u) & mask)
+    {
+      const uint32_t home = hash(slots[j].key);
+
+      // Move the slot to the gap if its home is not in (i, j]
+      const bool in_range = i <= j ? (i < home && home <= j)
+                                   : (i < home || home <= j);
+      if (!in_range)
+      {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+
+    slots[i].key = invalid;
+    --size;
+  }
+
+  inline void reserve(uint32_t num_keys)
+  {
+    uint32_t capacity = 64u;
+    while (capacity < num_keys * 2u)
+      capacity *= 2u;
+
+    if (capacity > (uint32_t)slots.size())
+      rehash(capacity);
+  }
+
+  inline void clear()
+  {
+    if (size > 0u)
+      memset(slots.data(), 0xFF, slots.size() * sizeof(slot_t));
+    size = 0u;
+  }
+
+  uint32_t size{0u};
+
+private:
+  inline auto hash(uint32_t key) const -> uint32_t
+  {
+    // Fibonacci hashing
+    return (key * 2654435769u) >> shift;
+  }
+
+  inline void rehash(uint32_t capacity)
+  {
+    std::vector<slot_t> old_slots(capacity, slot_t{invalid, invalid});
+    old_slots.swap(slots);
+
+    mask = capacity - 1u;
+    shift = 32u - (uint32_t)_tzcnt_u32(capacity);
+    size = 0u;
+
+    for (const auto& slot : old_slots)
+    {
+      if (slot.key != invalid)
+        insert(slot.key, slot.value);
+    }
+  }
+
+  std::vector<slot_t> slots;
+  uint32_t mask{0u};
+  uint32_t shift{32u};
+};
+
+//----------------------------------------------------------------------------//
+// Maps voxel coordinates using a signed permutation of the axes followed by a
+// translation. Covers all combinations of 90 degree rotations, mirroring and
+// transposing while staying in integer arithmetic.
+struct voxel_transform_t
+{
+  inline static auto identity() -> voxel_transform_t
+  {
+    return {{0u, 1u, 2u}, {1, 1, 1}, {0, 0, 0}};
+  }
+
+  // Rotates in steps of 90 degrees around the x, y and z axis (in this order)
+  inline static auto rotation(io_u8vec3_t steps) -> voxel_transform_t
+  {
+    auto t = identity();
+    const uint8_t s[3] = {steps.x, steps.y, steps.z};
+
+    for (uint32_t a = 0u; a < 3u; ++a)
+    {
+      const uint32_t u = (a + 1u) % 3u, v = (a + 2u) % 3u;
+      for (uint32_t i = 0u; i < (s[a] & 3u); ++i)
+      {
+        // (u, v) -> (-v, u)
+        const uint8_t axis_u = t.axis[u];
+        const int32_t sign_u = t.sign[u], offset_u = t.offset[u];
+        t.axis[u] = t.axis[v];
+        t.sign[u] = -t.sign[v];
+        t.offset[u] = -t.offset[v];
+        t.axis[v] = axis_u;
+        t.sign[v] = sign_u;
+        t.offset[v] = offset_u;
+      }
+    }
+
+    return t;
+  }
+
+  // Mirrors the voxels of the given axes (bit 0: x, bit 1: y, bit 2: z) at
+  // the center of a volume with the given dimensions
+  inline static auto mirror(uint8_t axis_mask,
+                            io_u16vec3_t dim) -> voxel_transform_t
+  {
+    auto t = identity();
+    const uint16_t d[3] = {dim.x, dim.y, dim.z};
+
+    for (uint32_t i = 0u; i < 3u; ++i)
+    {
+      if (axis_mask & (1u << i))
+      {
+        t.sign[i] = -1;
+        t.offset[i] = d[i] - 1;
+      }
+    }
+
+    return t;
+  }
+
+  // Swaps the given axes
+  inline static auto transpose(uint32_t a, uint32_t b) -> voxel_transform_t
+  {
+    auto t = identity();
+    std::swap(t.axis[a], t.axis[b]);
+    return t;
+  }
+
+  // Returns the transform applying "other" first and this transform second
+  inline auto operator*(const voxel_transform_t& other) const
+      -> voxel_transform_t
+  {
+    voxel_transform_t t;
+    for (uint32_t i = 0u; i < 3u; ++i)
+    {
+      t.axis[i] = other.axis[axis[i]];
+      t.sign[i] = sign[i] * other.sign[axis[i]];
+      t.offset[i] = sign[i] * other.offset[axis[i]] + offset[i];
+    }
+
+    return t;
+  }
+
+  // Returns the extent of a box with the given extent after the transform
+  inline auto apply_to_extent(io_u16vec3_t extent) const -> io_u16vec3_t
+  {
+    const uint16_t e[3] = {extent.x, extent.y, extent.z};
+    return {e[axis[0]], e[axis[1]], e[axis[2]]};
+  }
+
+  // Translates the transform so that the transformed box [0, extent) starts at
+  // the given minimum corner
+  inline auto fit(io_u16vec3_t extent,
+                  io_ivec3_t min_corner) const -> voxel_transform_t
+  {
+    const int32_t e[3] = {extent.x, extent.y, extent.z};
+    const int32_t m[3] = {min_corner.x, min_corner.y, min_corner.z};
+
+    auto t = *this;
+    for (uint32_t i = 0u; i < 3u; ++i)
+      t.offset[i] = m[i] - std::min(0, sign[i] * (e[axis[i]] - 1));
+
+    return t;
+  }
+
+  // Transforms the coordinate of the given packed voxel
+  inline auto apply(uint32_t packed) const -> io_ivec3_t
+  {
+    const int32_t c[3] = {(int32_t)(packed & 0xFFu),
+                          (int32_t)((packed >> 8u) & 0xFFu),
+                          (int32_t)((packed >> 16u) & 0xFFu)};
+    return {sign[0] * c[axis[0]] + offset[0], sign[1] * c[axis[1]] + offset[1],
+            sign[2] * c[axis[2]] + offset[2]};
+  }
+
+  // Output axis i reads input axis "axis[i]"
+  uint8_t axis[3];
+  int32_t sign[3];
+  int32_t offset[3];
 };
 
 //----------------------------------------------------------------------------//
@@ -157,40 +691,63 @@ struct sparse_volume_t
       *palette_index = (packed_value >> 24u) & 0xFFu;
   }
 
+  // Adds the mirrored voxels for all combinations of the given axes (bit 0:
+  // x, bit 1: y, bit 2: z) in a single pass over the original entries.
+  // Existing voxels are kept, so where the mirrored voxels of two entries
+  // overlap, the one of the entry visited first wins.
   void mirror(io_ref_t shape, uint8_t axis_mask)
   {
+    axis_mask &= 0x7u;
     if (!axis_mask)
       return;
 
     const auto dim = io_component_voxel_shape->get_dim(shape);
-    const auto center = io_vec3_t{dim.x * 0.5f, dim.y * 0.5f, dim.z * 0.5f};
+    const uint32_t num_entries = (uint32_t)entries.size();
+    reserve(num_entries << std::popcount(axis_mask));
 
-    for (uint32_t i = 0u; i < 3u; ++i)
+    voxel_transform_t transforms[7];
+    uint32_t num_transforms = 0u;
+    for (uint32_t combination = 1u; combination < 8u; ++combination)
     {
-      if ((axis_mask & (1u << i)) == 0u)
-        continue;
-
-      // Copy so we can read while creating new ones
-      const auto entries_read = entries;
+      if ((combination & axis_mask) == combination)
+        transforms[num_transforms++] =
+            voxel_transform_t::mirror(combination, dim);
+    }
 
-      for (auto e : entries_read)
-      {
-        io_u8vec3_t coord;
-        uint8_t palette_index;
-        unpack(e.data, coord.x, coord.y, coord.z, &palette_index);
+    for (uint32_t i = 0u; i < num_entries; ++i)
+    {
+      const uint32_t data = entries[i].data;
+      for (uint32_t j = 0u; j < num_transforms; ++j)
+        set(transforms[j].apply(data), (data >> 24u) & 0xFFu, dim);
+    }
+  }
 
-        const auto coord_float =
-            io_vec3_t{coord.x + 0.5f, coord.y + 0.5f, coord.z + 0.5f};
+  // Transforms all voxels in place. Voxels ending up outside of the given
+  // dimensions are removed.
+  void transform(const voxel_transform_t& t, io_u16vec3_t max_dim)
+  {
+    occupancy.clear();
+    index.clear();
+    index.reserve((uint32_t)entries.size());
 
-        auto coord_mirr = coord_float;
-        coord_mirr.data[i] =
-            center.data[i] - (coord_float.data[i] - center.data[i]);
+    // Signed permutations are bijective, so the transformed voxels never
+    // collide
+    uint32_t num_entries = 0u;
+    for (const auto& e : entries)
+    {
+      const auto coord = t.apply(e.data);
+      if (!is_coord_valid(coord, max_dim))
+        continue;
 
-        set(io_ivec3_t{(int16_t)coord_mirr.x, (int16_t)coord_mirr.y,
-                       (int16_t)coord_mirr.z},
-            palette_index, dim);
-      }
+      const uint32_t packed =
+          pack(coord.x, coord.y, coord.z, (e.data >> 24u) & 0xFFu);
+      occupancy.set(coord, true);
+      index.insert(packed & coord_mask, num_entries);
+      entries[num_entries++] = {packed, io_box_face_flags_all};
     }
+    entries.resize(num_entries);
+
+    memset(dirty_cells, 0xFF, sizeof(dirty_cells));
   }
 
   template <remove_mode_t Mode> void remove_voxels(io_ref_t shape)
@@ -198,42 +755,38 @@ struct sparse_volume_t
     const auto data = io_component_voxel_shape->get_voxel_data(shape);
     const auto dim = io_component_voxel_shape->get_dim(shape);
 
-    sparse_volume_t updated_volume;
-
-    for (auto e : entries)
+    // Visit the entries back to front, so the entries "erase" moves to the
+    // gaps have already been checked
+    for (uint32_t i = (uint32_t)entries.size(); i-- > 0u;)
     {
       io_u8vec3_t coord;
-      uint8_t palette_index;
-      unpack(e.data, coord.x, coord.y, coord.z, &palette_index);
-
-      if (!is_coord_valid(coord, dim))
-        continue;
-
-      const uint32_t index =
-          coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
+      unpack(entries[i].data, coord.x, coord.y, coord.z);
 
-      if constexpr (Mode == remove_mode_non_solid)
+      bool remove = !is_coord_valid(coord, dim);
+      if (!remove)
       {
-        if (data[index] == 0u)
-          continue;
-      }
-      else if constexpr (Mode == remove_mode_solid)
-      {
-        if (data[index] != 0u)
-          continue;
+        const uint32_t index =
+            coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
+
+        if constexpr (Mode == remove_mode_non_solid)
+          remove = data[index] == 0u;
+        else if constexpr (Mode == remove_mode_solid)
+          remove = data[index] != 0u;
       }
 
-      updated_volume.set(coord, palette_index, dim);
+      if (remove)
+        erase(coord);
     }
-
-    *this = updated_volume;
   }
 
+  // Writes the voxels to the shape and voxelizes the bounds of the voxels
+  // which changed
   void apply(io_ref_t shape) const
   {
     const auto data = io_component_voxel_shape->get_voxel_data(shape);
     const auto dim = io_component_voxel_shape->get_dim(shape);
 
+    voxel_aabb_t bounds;
     for (auto e : entries)
     {
       io_u8vec3_t coord;
@@ -245,10 +798,14 @@ struct sparse_volume_t
 
       const uint32_t index =
           coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
-      data[index] = palette_index;
+      if (data[index] != palette_index)
+      {
+        data[index] = palette_index;
+        bounds.add(coord.x, coord.y, coord.z);
+      }
     }
 
-    io_component_voxel_shape->voxelize(shape);
+    common::voxelize(shape, bounds);
   }
 
   void add_by_palette_index(io_ref_t shape, io_u8vec3_t start_coord)
@@ -271,149 +828,148 @@ struct sparse_volume_t
         }
   }
 
+  // Adds the region of connected voxels starting at the given coordinate.
+  // Runs of voxels along x are filled at once (scanline fill) and seed the
+  // runs in the neighboring rows.
   void add_region(io_ref_t shape, io_u8vec3_t start_coord,
                   region_neighborhood_t neighborhood,
                   uint8_t axis_flags = 0xFFu,
-                  io_ivec3_t exclude_dir = {0, 0, 0}, bool match_color = false,
-                  io_ref_t palette = {}, float fuziness = 0.0f)
+                  io_ivec3_t exclude_dir = {0, 0, 0},
+                  const palette_match_table_t& matches = {})
   {
     const auto data = io_component_voxel_shape->get_voxel_data(shape);
     const auto dim = io_component_voxel_shape->get_dim(shape);
+    const int32_t pitch_y = dim.x, pitch_z = dim.x * dim.y;
+
+    const uint32_t start_index =
+        start_coord.x + start_coord.y * pitch_y + start_coord.z * pitch_z;
+
+    // Voxels with a solid neighbor in the excluded direction are neither
+    // added nor expanded. The start voxel is added regardless of its color
+    const bool has_exclude_dir =
+        exclude_dir.x != 0 || exclude_dir.y != 0 || exclude_dir.z != 0;
+    const auto is_fillable = [&](int32_t x, int32_t y, int32_t z,
+                                 uint32_t index) -> bool {
+      if (has_exclude_dir)
+      {
+        const int32_t ex = x + exclude_dir.x, ey = y + exclude_dir.y,
+                      ez = z + exclude_dir.z;
+        if (ex >= 0 && ey >= 0 && ez >= 0 && ex < dim.x && ey < dim.y &&
+            ez < dim.z && data[ex + ey * pitch_y + ez * pitch_z] != 0u)
+          return false;
+      }
 
-    const auto start_palette_index =
-        data[start_coord.x + start_coord.y * dim.x +
-             start_coord.z * dim.x * dim.y];
-    const glm::vec3 start_color = io_cvt(
-        io_resource_palette->get_color(palette, start_palette_index - 1u));
-    const float fuziness2 = fuziness * fuziness;
-
-    std::vector<io_u8vec3_t> stack;
-    stack.emplace_back(start_coord);
-    std::vector<bool> mask(dim.x * dim.y * dim.z);
-
-    const auto is_set = [&dim, &data, &stack, &mask, match_color,
-                         start_palette_index](io_ivec3_t coord) -> bool {
-      if (coord.x < 0 || coord.y < 0 || coord.z < 0 || coord.x >= dim.x ||
-          coord.y >= dim.y || coord.z >= dim.z)
-        return false;
-
-      const auto index = coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
-      return data[index] != 0u;
+      return index == start_index || matches[data[index]];
     };
 
-    const auto add_coord = [&dim, &data, &stack, &mask, match_color,
-                            start_palette_index, palette, fuziness2,
-                            start_color](io_ivec3_t coord) {
-      if (coord.x < 0 || coord.y < 0 || coord.z < 0 || coord.x >= dim.x ||
-          coord.y >= dim.y || coord.z >= dim.z)
-        return;
+    // Rows adjacent to a run and by how many voxels the run is extended on
+    // both sides when scanning them (for the diagonal neighbors)
+    const bool axis_x = (axis_flags & 0x01u) != 0u,
+               axis_y = (axis_flags & 0x02u) != 0u,
+               axis_z = (axis_flags & 0x04u) != 0u;
+    const bool is_18_or_26 = neighborhood == region_neighborhood_18 ||
+                             neighborhood == region_neighborhood_26;
 
-      const auto index = coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
-      if (mask[index])
-        return;
+    struct neighbor_row_t
+    {
+      int32_t dy, dz;
+      int32_t extent;
+    };
+    neighbor_row_t neighbor_rows[8];
+    uint32_t num_neighbor_rows = 0u;
 
-      const auto palette_index = data[index];
-      bool match = palette_index != 0u;
-      if (match && match_color)
-      {
-        if (fuziness2 > 0.0f)
-        {
-          const glm::vec3 color = io_cvt(
-              io_resource_palette->get_color(palette, palette_index - 1u));
-          match = glm::distance2(color, start_color) < fuziness2;
-        }
-        else
-        {
-          match = palette_index == start_palette_index;
-        }
-      }
+    if (axis_y)
+    {
+      const int32_t extent = is_18_or_26 && axis_x ? 1 : 0;
+      neighbor_rows[num_neighbor_rows++] = {1, 0, extent};
+      neighbor_rows[num_neighbor_rows++] = {-1, 0, extent};
+    }
+    if (axis_z)
+    {
+      const int32_t extent = is_18_or_26 && axis_x ? 1 : 0;
+      neighbor_rows[num_neighbor_rows++] = {0, 1, extent};
+      neighbor_rows[num_neighbor_rows++] = {0, -1, extent};
+    }
+    if (is_18_or_26 && axis_y && axis_z)
+    {
+      const int32_t extent =
+          neighborhood == region_neighborhood_26 && axis_x ? 1 : 0;
+      neighbor_rows[num_neighbor_rows++] = {1, 1, extent};
+      neighbor_rows[num_neighbor_rows++] = {-1, -1, extent};
+      neighbor_rows[num_neighbor_rows++] = {1, -1, extent};
+      neighbor_rows[num_neighbor_rows++] = {-1, 1, extent};
+    }
 
-      if (match)
-      {
-        stack.push_back({(uint8_t)coord.x, (uint8_t)coord.y, (uint8_t)coord.z});
-        mask[index] = true;
-      }
-    };
+    // Scratch memory is reused between calls on the same volume
+    auto& visited = region_visited;
+    auto& seeds = region_seeds;
+    visited.assign(((uint32_t)pitch_z * dim.z + 63u) / 64u, 0u);
+    seeds.clear();
 
-    while (!stack.empty())
-    {
-      const auto coord = stack.back();
-      stack.pop_back();
+    const auto is_visited = [&visited](uint32_t index) -> bool {
+      return (visited[index >> 6u] >> (index & 63u)) & 1u;
+    };
 
-      if (exclude_dir.x != 0 || exclude_dir.y != 0 || exclude_dir.z != 0)
-      {
-        if (is_set({coord.x + exclude_dir.x, coord.y + exclude_dir.y,
-                    coord.z + exclude_dir.z}))
-          continue;
-      }
+    if (is_fillable(start_coord.x, start_coord.y, start_coord.z, start_index))
+      seeds.push_back(start_coord);
 
-      // Add this voxel to the volume
-      const auto palette_index =
-          data[coord.x + coord.y * dim.x + coord.z * dim.x * dim.y];
-      set(coord, palette_index, dim);
+    while (!seeds.empty())
+    {
+      const auto seed = seeds.back();
+      seeds.pop_back();
 
-      // Queue its neighbors
-      if ((axis_flags & 0x01u) == 0x01u)
-      {
-        add_coord({coord.x + 1, coord.y, coord.z});
-        add_coord({coord.x - 1, coord.y, coord.z});
-      }
+      const int32_t y = seed.y, z = seed.z;
+      const uint32_t row_index = y * pitch_y + z * pitch_z;
+      if (is_visited(row_index + seed.x))
+        continue;
 
-      if ((axis_flags & 0x02u) == 0x02u)
+      // Expand the run along x
+      int32_t x0 = seed.x, x1 = seed.x;
+      if (axis_x)
       {
-        add_coord({coord.x, coord.y + 1, coord.z});
-        add_coord({coord.x, coord.y - 1, coord.z});
+        while (x0 > 0 && !is_visited(row_index + x0 - 1) &&
+               is_fillable(x0 - 1, y, z, row_index + x0 - 1))
+          --x0;
+        while (x1 < dim.x - 1 && !is_visited(row_index + x1 + 1) &&
+               is_fillable(x1 + 1, y, z, row_index + x1 + 1))
+          ++x1;
       }
 
-      if ((axis_flags & 0x04u) == 0x04u)
+      for (int32_t x = x0; x <= x1; ++x)
       {
-        add_coord({coord.x, coord.y, coord.z + 1});
-        add_coord({coord.x, coord.y, coord.z - 1});
+        const uint32_t index = row_index + x;
+        visited[index >> 6u] |= 1ull << (index & 63u);
+        set(x, y, z, data[index], dim);
       }
 
-      if (neighborhood == region_neighborhood_18 ||
-          neighborhood == region_neighborhood_26)
+      // Seed one voxel per run in the neighboring rows
+      for (uint32_t i = 0u; i < num_neighbor_rows; ++i)
       {
-        if ((axis_flags & 0x03u) == 0x03u)
-        {
-          add_coord({coord.x + 1, coord.y + 1, coord.z});
-          add_coord({coord.x - 1, coord.y - 1, coord.z});
-          add_coord({coord.x + 1, coord.y - 1, coord.z});
-          add_coord({coord.x - 1, coord.y + 1, coord.z});
-        }
-
-        if ((axis_flags & 0x05u) == 0x05u)
-        {
-          add_coord({coord.x + 1, coord.y, coord.z + 1});
-          add_coord({coord.x - 1, coord.y, coord.z - 1});
-          add_coord({coord.x + 1, coord.y, coord.z - 1});
-          add_coord({coord.x - 1, coord.y, coord.z + 1});
-        }
+        const auto& row = neighbor_rows[i];
+        const int32_t ny = y + row.dy, nz = z + row.dz;
+        if (ny < 0 || nz < 0 || ny >= dim.y || nz >= dim.z)
+          continue;
 
-        if ((axis_flags & 0x06u) == 0x06u)
-        {
-          add_coord({coord.x, coord.y + 1, coord.z + 1});
-          add_coord({coord.x, coord.y - 1, coord.z - 1});
-          add_coord({coord.x, coord.y + 1, coord.z - 1});
-          add_coord({coord.x, coord.y - 1, coord.z + 1});
-        }
+        const uint32_t neighbor_row_index = ny * pitch_y + nz * pitch_z;
+        const int32_t begin = std::max(x0 - row.extent, 0);
+        const int32_t end = std::min(x1 + row.extent, dim.x - 1);
 
-        if (neighborhood == region_neighborhood_26)
+        bool in_run = false;
+        for (int32_t x = begin; x <= end; ++x)
         {
-          if ((axis_flags & 0x07u) == 0x07u)
+          const uint32_t index = neighbor_row_index + x;
+          if (is_visited(index) || !is_fillable(x, ny, nz, index))
           {
-            add_coord({coord.x + 1, coord.y + 1, coord.z + 1});
-            add_coord({coord.x - 1, coord.y - 1, coord.z - 1});
-            add_coord({coord.x + 1, coord.y + 1, coord.z - 1});
-            add_coord({coord.x - 1, coord.y - 1, coord.z + 1});
-            add_coord({coord.x + 1, coord.y - 1, coord.z + 1});
-            add_coord({coord.x - 1, coord.y + 1, coord.z - 1});
-            add_coord({coord.x - 1, coord.y + 1, coord.z + 1});
-            add_coord({coord.x + 1, coord.y - 1, coord.z - 1});
+            in_run = false;
+            continue;
           }
+
+          if (!in_run)
+            seeds.push_back({(uint8_t)x, (uint8_t)ny, (uint8_t)nz});
+          in_run = axis_x;
         }
       }
-    };
+    }
   }
 
   sparse_volume_t prepare_fill(io_ref_t shape, const palette_range_t& range,
@@ -467,177 +1023,362 @@ struct sparse_volume_t
 
   void update_from_shape(io_ref_t shape)
   {
-    sparse_volume_t updated_volume;
-    updated_volume.entries.reserve(entries.size());
-
     const auto data = io_component_voxel_shape->get_voxel_data(shape);
     const auto dim = io_component_voxel_shape->get_dim(shape);
 
-    for (auto e : entries)
+    // Drop voxels outside of the shape and update the palette indices of the
+    // remaining ones in place. Visited back to front, so the entries "erase"
+    // moves to the gaps have already been updated. The cached faces of
+    // changed voxels have to be rebuilt.
+    for (uint32_t i = (uint32_t)entries.size(); i-- > 0u;)
     {
+      auto& e = entries[i];
+
       io_u8vec3_t coord;
       unpack(e.data, coord.x, coord.y, coord.z);
 
       if (!is_coord_valid(coord, dim))
+      {
+        erase(coord);
         continue;
+      }
 
       const uint32_t index =
           coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
-      const auto current_palette_index = data[index];
+      const uint32_t packed = pack(coord.x, coord.y, coord.z, data[index]);
+      if (packed == e.data)
+        continue;
 
-      updated_volume.set(coord.x, coord.y, coord.z, current_palette_index, dim);
+      e.data = packed;
+      mark_dirty(coord.x, coord.y, coord.z);
     }
-
-    entries = std::move(updated_volume.entries);
   }
 
+  // Draws the merged faces built by the last call to "cull_for_draw"
   void draw(io_ref_t shape, bool disable_outlines = false,
             bool disable_solids = false)
   {
-    const auto entity = io_component_voxel_shape->base.get_entity(shape);
     const auto palette = io_component_voxel_shape->get_palette(shape);
 
-    if (!io_ref_is_valid(palette))
+    if (!io_ref_is_valid(palette) || mesh.empty())
       return;
 
-    const auto dim = io_component_voxel_shape->get_dim(shape);
-    const auto node = io_component_node->base.get_component_for_entity(entity);
+    // The transform from voxel to world space is affine, so derive it once
+    // instead of transforming every single voxel via the API
+    const glm::vec3 origin =
+        io_cvt(io_component_voxel_shape->to_world_space(shape, {0.0f}));
+    const glm::vec3 axes[] = {
+        io_cvt(io_component_voxel_shape->to_world_space(
+            shape, {1.0f, 0.0f, 0.0f})) -
+            origin,
+        io_cvt(io_component_voxel_shape->to_world_space(
+            shape, {0.0f, 1.0f, 0.0f})) -
+            origin,
+        io_cvt(io_component_voxel_shape->to_world_space(
+            shape, {0.0f, 0.0f, 1.0f})) -
+            origin};
+
+    // Quads pointing away from the camera are culled in voxel space
+    const glm::vec3 camera_vs =
+        io_cvt(io_component_voxel_shape->to_local_space(
+            shape, io_cvt(common::get_camera_position())));
+
+    // Inflate the quads slightly (in voxel units per axis)
+    constexpr float inflate = 0.01f;
+    float extents[3];
+    __m128 ax[3];
+    for (uint32_t a = 0u; a < 3u; ++a)
+    {
+      extents[a] = 0.5f * inflate / glm::max(glm::length(axes[a]), 1e-6f);
+      ax[a] = _mm_setr_ps(axes[a].x, axes[a].y, axes[a].z, 0.0f);
+    }
+    const __m128 o = _mm_setr_ps(origin.x, origin.y, origin.z, 0.0f);
 
-    io_debug_geometry->backface_culling_begin();
+    if (!disable_solids)
+      triangles.resize(mesh.size() * 6u);
+    if (!disable_outlines)
+      lines.resize(mesh.size() * 8u);
 
-    for (auto e : entries)
+    const auto store = [](io_vec3_t& dst, __m128 v) {
+      _mm_storel_pi((__m64*)&dst.x, v);
+      _mm_store_ss(&dst.z, _mm_movehl_ps(v, v));
+    };
+
+    // The quads are sorted by palette index, so each color is submitted once
+    uint32_t num_quads = 0u;
+    for (uint32_t i = 0u; i < 256u; ++i)
     {
-      io_u8vec3_t coord;
-      uint8_t palette_index;
-      unpack(e.data, coord.x, coord.y, coord.z, &palette_index);
+      const uint32_t first_quad = num_quads;
 
-      if (e.face_flags == 0u)
-        continue;
+      for (uint32_t j = mesh_starts[i]; j < mesh_starts[i + 1u]; ++j)
+      {
+        const auto& q = mesh[j];
+        const uint32_t a = face_axis[q.face];
+        const uint32_t ua = (a + 1u) % 3u, va = (a + 2u) % 3u;
+        const bool positive = is_face_positive[q.face];
 
-      if (!is_coord_valid(coord, dim))
-        continue;
+        const float plane = q.slice + (positive ? 1.0f : 0.0f);
+        if (positive ? camera_vs[a] <= plane : camera_vs[a] >= plane)
+          continue;
 
-      const uint32_t index =
-          coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
+        const float p = plane + (positive ? extents[a] : -extents[a]);
+        const float u0 = q.u - extents[ua], v0 = q.v - extents[va];
+        const float u1 = q.u + q.w + 1.0f + extents[ua],
+                    v1 = q.v + q.h + 1.0f + extents[va];
+
+        __m128 c00 = _mm_fmadd_ps(ax[a], _mm_set1_ps(p), o);
+        c00 = _mm_fmadd_ps(ax[ua], _mm_set1_ps(u0), c00);
+        c00 = _mm_fmadd_ps(ax[va], _mm_set1_ps(v0), c00);
+        const __m128 du = _mm_mul_ps(ax[ua], _mm_set1_ps(u1 - u0));
+        const __m128 dv = _mm_mul_ps(ax[va], _mm_set1_ps(v1 - v0));
+
+        // Counter clockwise as seen from the outside
+        __m128 c[4] = {c00, _mm_add_ps(c00, du),
+                       _mm_add_ps(_mm_add_ps(c00, du), dv),
+                       _mm_add_ps(c00, dv)};
+        if (!positive)
+          std::swap(c[1], c[3]);
+
+        if (!disable_solids)
+        {
+          io_vec3_t* t = &triangles[num_quads * 6u];
+          store(t[0], c[0]);
+          store(t[1], c[1]);
+          store(t[2], c[2]);
+          store(t[3], c[0]);
+          store(t[4], c[2]);
+          store(t[5], c[3]);
+        }
+
+        if (!disable_outlines)
+        {
+          io_vec3_t* l = &lines[num_quads * 8u];
+          for (uint32_t e = 0u; e < 4u; ++e)
+          {
+            store(l[e * 2u], c[e]);
+            store(l[e * 2u + 1u], c[(e + 1u) & 3u]);
+          }
+        }
+
+        ++num_quads;
+      }
 
-      const auto center_vs =
-          io_vec3_t{coord.x + 0.5f, coord.y + 0.5f, coord.z + 0.5f};
-      const auto center_ws =
-          io_component_voxel_shape->to_world_space(shape, center_vs);
+      if (num_quads == first_quad)
+        continue;
 
-      auto size = io_component_node->get_world_size(node);
       auto color = io_vec4_t{0.5f, 0.5f, 0.5f, 1.0f};
-      if (palette_index > 0u)
-        color = io_resource_palette->get_color(palette, palette_index - 1u);
+      if (i > 0u)
+        color = io_resource_palette->get_color(palette, i - 1u);
 
-      constexpr float inflate = 0.01f;
       if (!disable_solids)
-      {
-        io_debug_geometry->draw_solid_box(
-            center_ws, io_component_node->get_world_orientation(node),
-            {size.x + inflate, size.y + inflate, size.z + inflate}, color,
-            false, e.face_flags);
-      }
+        io_debug_geometry->draw_solid_triangles(
+            &triangles[first_quad * 6u], (num_quads - first_quad) * 6u, color,
+            false);
 
       if (!disable_outlines)
       {
         color.w = 0.75f;
-        io_debug_geometry->draw_box(
-            center_ws, io_component_node->get_world_orientation(node),
-            {size.x + inflate, size.y + inflate, size.z + inflate}, color, true,
-            e.face_flags);
+        io_debug_geometry->draw_lines(&lines[first_quad * 8u],
+                                      (num_quads - first_quad) * 8u, color,
+                                      true);
       }
     }
-
-    io_debug_geometry->backface_culling_end();
   }
 
+  // Updates the face flags and merged faces of all cells which have been
+  // changed since the last call and gathers the merged faces used for
+  // drawing. Large workloads are spread to the worker threads of the
+  // scheduler, one 32^3 cell per workload.
   inline void cull_for_draw(io_ref_t shape)
   {
     const auto dim = io_component_voxel_shape->get_dim(shape);
+    if (dim.x != cull_dim.x || dim.y != cull_dim.y || dim.z != cull_dim.z)
+    {
+      memset(dirty_cells, 0xFF, sizeof(dirty_cells));
+      cull_dim = dim;
+    }
 
-    sparse_occupancy_mask_t mask;
+    bool any_dirty = false;
+    for (uint64_t d : dirty_cells)
+      any_dirty |= d != 0u;
+    if (!any_dirty)
+      return;
 
-    // Build mask for culling
-    for (auto e : entries)
+    // Cells left without entries keep no faces
+    cell_meshes.resize(num_cells);
+    for (uint32_t i = 0u; i < num_cells; ++i)
     {
-      io_u8vec3_t coord;
-      unpack(e.data, coord.x, coord.y, coord.z);
+      if (is_cell_dirty(i))
+        cell_meshes[i].clear();
+    }
 
-      if (!is_coord_valid(coord, dim))
-        continue;
+    // Partition the entries of the dirty cells by cell (counting sort)
+    uint32_t cell_starts[num_cells + 1u] = {};
+    for (const auto& e : entries)
+    {
+      const uint32_t cell = calc_cell_index(e.data);
+      if (is_cell_dirty(cell))
+        ++cell_starts[cell + 1u];
+    }
 
-      mask.set(coord, true);
+    cull_cells.clear();
+    for (uint32_t i = 0u; i < num_cells; ++i)
+    {
+      if (cell_starts[i + 1u] > 0u)
+        cull_cells.push_back(i);
+      cell_starts[i + 1u] += cell_starts[i];
     }
 
-    auto is_voxel_set = [&dim, &mask](int32_t x, int32_t y, int32_t z) -> bool {
-      if (x >= dim.x || y >= dim.y || z >= dim.z || x < 0 || y < 0 || z < 0)
-        return false;
+    const uint32_t num_dirty_entries = cell_starts[num_cells];
+    cull_entries.resize(num_dirty_entries);
+    {
+      uint32_t offsets[num_cells];
+      memcpy(offsets, cell_starts, sizeof(offsets));
 
-      return mask.get(io_ivec3_t{x, y, z});
-    };
+      for (uint32_t i = 0u; i < (uint32_t)entries.size(); ++i)
+      {
+        const uint32_t cell = calc_cell_index(entries[i].data);
+        if (is_cell_dirty(cell))
+          cull_entries[offsets[cell]++] = i;
+      }
+    }
 
-    // Update entries according to the results
-    for (auto& e : entries)
-    {
-      io_u8vec3_t coord;
-      unpack(e.data, coord.x, coord.y, coord.z);
+    cull_task_t task;
+    io_init_scheduler_task(&task, (uint32_t)cull_cells.size(),
+                           cull_task_t::execute);
+    task.volume = this;
+    task.cell_starts = cell_starts;
 
-      const auto coord_int = io_ivec3_t{coord.x, coord.y, coord.z};
-
-      // Check which faces are exposed
-      e.face_flags = 0u;
-      // Front
-      e.face_flags |=
-          uint8_t(!is_voxel_set(coord_int.x, coord_int.y, coord_int.z + 1))
-          << io_box_face_index_front;
-      // Back
-      e.face_flags |=
-          uint8_t(!is_voxel_set(coord_int.x, coord_int.y, coord_int.z - 1))
-          << io_box_face_index_back;
-      // Top
-      e.face_flags |=
-          uint8_t(!is_voxel_set(coord_int.x, coord_int.y + 1, coord_int.z))
-          << io_box_face_index_top;
-      // Bottom
-      e.face_flags |=
-          uint8_t(!is_voxel_set(coord_int.x, coord_int.y - 1, coord_int.z))
-          << io_box_face_index_bottom;
-      // Left
-      e.face_flags |=
-          uint8_t(!is_voxel_set(coord_int.x - 1, coord_int.y, coord_int.z))
-          << io_box_face_index_left;
-      // Right
-      e.face_flags |=
-          uint8_t(!is_voxel_set(coord_int.x + 1, coord_int.y, coord_int.z))
-          << io_box_face_index_right;
+    // Not worth the overhead for small volumes
+    if (num_dirty_entries >= 16384u && cull_cells.size() > 1u)
+    {
+      io_base->scheduler_enqueue_task(&task);
+      io_base->scheduler_wait_for_task(&task);
+    }
+    else
+    {
+      cull_task_t::execute({0u, (uint32_t)cull_cells.size()}, 0u, 0u, &task);
     }
+
+    memset(dirty_cells, 0, sizeof(dirty_cells));
+    build_mesh();
   }
 
   inline void set(int32_t x, int32_t y, int32_t z, uint8_t palette_index,
-                  io_u16vec3_t max_dim)
+                  io_u16vec3_t max_dim, bool overwrite = false)
   {
     const auto coord_int = io_ivec3_t{x, y, z};
     if (!is_coord_valid(coord_int, max_dim))
       return;
 
-    // Skip existing entries
+    const uint32_t packed = pack(x, y, z, palette_index);
+
     const bool changed = occupancy.set(coord_int, true);
     if (!changed)
+    {
+      // Skip existing entries (or update the palette index)
+      if (overwrite)
+      {
+        auto& e = entries[index.find(packed & coord_mask)];
+        if (e.data != packed)
+        {
+          e.data = packed;
+          mark_dirty(x, y, z);
+        }
+      }
       return;
+    }
 
-    entries.push_back({pack(x, y, z, palette_index), io_box_face_flags_all});
+    index.insert(packed & coord_mask, (uint32_t)entries.size());
+    entries.push_back({packed, io_box_face_flags_all});
+    mark_dirty(x, y, z);
   }
 
   inline void set(io_u8vec3_t coord, uint8_t palette_index,
-                  io_u16vec3_t max_dim)
+                  io_u16vec3_t max_dim, bool overwrite = false)
+  {
+    set(coord.x, coord.y, coord.z, palette_index, max_dim, overwrite);
+  }
+
+  inline void set(io_ivec3_t coord, uint8_t palette_index, io_u16vec3_t max_dim,
+                  bool overwrite = false)
+  {
+    set(coord.x, coord.y, coord.z, palette_index, max_dim, overwrite);
+  }
+
+  // Retrieves the palette index of the given voxel. Returns false if the
+  // coordinate is outside of the 256^3 grid or the volume does not contain
+  // the voxel.
+  inline auto get(io_ivec3_t coord, uint8_t& palette_index) const -> bool
+  {
+    if (!is_coord_valid(coord, grid_dim) || !occupancy.get(coord))
+      return false;
+
+    const auto& e = entries[index.find(pack(coord.x, coord.y, coord.z, 0u))];
+    palette_index = (e.data >> 24u) & 0xFFu;
+
+    return true;
+  }
+
+  inline auto get(io_u8vec3_t coord, uint8_t& palette_index) const -> bool
+  {
+    return get(io_ivec3_t{coord.x, coord.y, coord.z}, palette_index);
+  }
+
+  // Removes the given voxel. Returns false if the coordinate is outside of
+  // the 256^3 grid or the volume does not contain the voxel.
+  inline auto erase(io_ivec3_t coord) -> bool
+  {
+    if (!is_coord_valid(coord, grid_dim) || !occupancy.set(coord, false))
+      return false;
+    mark_dirty(coord.x, coord.y, coord.z);
+
+    const uint32_t key = pack(coord.x, coord.y, coord.z, 0u);
+    const uint32_t entry_index = index.find(key);
+    index.erase(key);
+
+    // Move the last entry to the gap
+    const uint32_t last_index = (uint32_t)entries.size() - 1u;
+    if (entry_index != last_index)
+    {
+      entries[entry_index] = entries[last_index];
+      index.insert(entries[entry_index].data & coord_mask, entry_index);
+    }
+    entries.pop_back();
+
+    return true;
+  }
+
+  inline auto erase(io_u8vec3_t coord) -> bool
+  {
+    return erase(io_ivec3_t{coord.x, coord.y, coord.z});
+  }
+
+  // Adds the voxels of the given brick mask (see "sparse_occupancy_mask_t")
+  // with one value per bit. Existing voxels are kept.
+  inline void add_brick(uint32_t bx, uint32_t by, uint32_t bz, uint64_t mask,
+                        const uint8_t values[64])
   {
-    set(coord.x, coord.y, coord.z, palette_index, max_dim);
+    uint64_t added = occupancy.or_brick(bx, by, bz, mask);
+    while (added)
+    {
+      const uint32_t bit = std::countr_zero(added);
+      added &= added - 1u;
+
+      const uint32_t x = bx * 4u + (bit & 3u), y = by * 4u + ((bit >> 2u) & 3u),
+                     z = bz * 4u + (bit >> 4u);
+      const uint32_t packed = pack(x, y, z, values[bit]);
+
+      index.insert(packed & coord_mask, (uint32_t)entries.size());
+      entries.push_back({packed, io_box_face_flags_all});
+      mark_dirty(x, y, z);
+    }
   }
 
-  inline void set(io_ivec3_t coord, uint8_t palette_index, io_u16vec3_t max_dim)
+  inline void reserve(uint32_t num_entries)
   {
-    set(coord.x, coord.y, coord.z, palette_index, max_dim);
+    entries.reserve(num_entries);
+    index.reserve(num_entries);
   }
 
   inline void add(const sparse_volume_t& other, io_u16vec3_t max_dim,
@@ -664,11 +1405,295 @@ struct sparse_volume_t
   {
     entries.clear();
     occupancy.clear();
+    index.clear();
+    cell_meshes.clear();
+    mesh.clear();
+    memset(dirty_cells, 0, sizeof(dirty_cells));
   }
   inline auto empty() const -> bool { return entries.empty(); }
 
   std::vector<entry_t> entries;
-  sparse_occupancy_mask_t<> occupancy;
+  sparse_occupancy_mask_t occupancy;
+  sparse_volume_index_t index;
+
+private:
+  static constexpr uint32_t coord_mask = 0xFFFFFFu;
+  inline static const io_u16vec3_t grid_dim = {256u, 256u, 256u};
+  static constexpr uint32_t num_cells = sparse_occupancy_mask_t::num_cells;
+
+  // Axis and orientation of the faces, indexed by "io_box_face_index"
+  static constexpr uint8_t face_axis[6] = {2u, 2u, 1u, 1u, 0u, 0u};
+  static constexpr bool is_face_positive[6] = {true,  false, true,
+                                               false, false, true};
+
+  // Rectangle of merged faces in the plane spanned by the two axes following
+  // the axis of the face
+  struct mesh_quad_t
+  {
+    uint8_t u, v;
+    uint8_t w, h; // Extent minus one
+    uint8_t slice;
+    uint8_t face;
+    uint8_t palette_index;
+  };
+
+  struct cull_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      auto task = (cull_task_t*)task_;
+      auto volume = task->volume;
+      std::vector<uint32_t> faces;
+
+      for (uint32_t i = range.x; i < range.y; ++i)
+      {
+        const uint32_t cell = volume->cull_cells[i];
+
+        // Exposed faces of the last brick visited; entries are mostly added
+        // in scanline order, so consecutive entries tend to share bricks
+        uint64_t brick_faces[6];
+        uint32_t cached_brick = UINT32_MAX;
+
+        for (uint32_t j = task->cell_starts[cell];
+             j < task->cell_starts[cell + 1u]; ++j)
+        {
+          auto& e = volume->entries[volume->cull_entries[j]];
+
+          io_u8vec3_t coord;
+          unpack(e.data, coord.x, coord.y, coord.z);
+
+          const uint32_t brick = (coord.x >> 2u) | ((coord.y >> 2u) << 6u) |
+                                 ((coord.z >> 2u) << 12u);
+          if (brick != cached_brick)
+          {
+            volume->occupancy.calc_exposed_faces(coord.x >> 2u, coord.y >> 2u,
+                                                 coord.z >> 2u, brick_faces);
+            cached_brick = brick;
+          }
+
+          // Check which faces are exposed
+          e.face_flags = sparse_occupancy_mask_t::extract_face_flags(
+              brick_faces, sparse_occupancy_mask_t::calc_bit_index(coord));
+        }
+
+        volume->build_cell_mesh(
+            cell, &volume->cull_entries[task->cell_starts[cell]],
+            task->cell_starts[cell + 1u] - task->cell_starts[cell], faces);
+      }
+    }
+
+    sparse_volume_t* volume;
+    const uint32_t* cell_starts;
+  };
+
+  inline static auto calc_cell_index(uint32_t packed) -> uint32_t
+  {
+    return ((packed >> 5u) & 7u) | (((packed >> 13u) & 7u) << 3u) |
+           (((packed >> 21u) & 7u) << 6u);
+  }
+
+  inline auto is_cell_dirty(uint32_t cell) const -> bool
+  {
+    return (dirty_cells[cell >> 6u] >> (cell & 63u)) & 1u;
+  }
+
+  inline void mark_cell_dirty(uint32_t cx, uint32_t cy, uint32_t cz)
+  {
+    const uint32_t cell = cx + (cy << 3u) + (cz << 6u);
+    dirty_cells[cell >> 6u] |= 1ull << (cell & 63u);
+  }
+
+  // Marks the cell of the given voxel as dirty. Voxels on the boundary of a
+  // cell also affect the faces of the voxels in the neighboring cell.
+  inline void mark_dirty(uint32_t x, uint32_t y, uint32_t z)
+  {
+    const uint32_t cx = x >> 5u, cy = y >> 5u, cz = z >> 5u;
+    mark_cell_dirty(cx, cy, cz);
+
+    if ((x & 31u) == 0u && cx > 0u)
+      mark_cell_dirty(cx - 1u, cy, cz);
+    else if ((x & 31u) == 31u && cx < 7u)
+      mark_cell_dirty(cx + 1u, cy, cz);
+    if ((y & 31u) == 0u && cy > 0u)
+      mark_cell_dirty(cx, cy - 1u, cz);
+    else if ((y & 31u) == 31u && cy < 7u)
+      mark_cell_dirty(cx, cy + 1u, cz);
+    if ((z & 31u) == 0u && cz > 0u)
+      mark_cell_dirty(cx, cy, cz - 1u);
+    else if ((z & 31u) == 31u && cz < 7u)
+      mark_cell_dirty(cx, cy, cz + 1u);
+  }
+
+  // Cells whose entries need to be culled again
+  uint64_t dirty_cells[num_cells / 64u] = {};
+  io_u16vec3_t cull_dim = {};
+
+  // Scratch memory for culling
+  std::vector<uint32_t> cull_cells, cull_entries;
+
+  // Merged faces of each cell and of all cells sorted by palette index
+  std::vector<std::vector<mesh_quad_t>> cell_meshes;
+  std::vector<mesh_quad_t> mesh;
+  uint32_t mesh_starts[257] = {};
+
+  // Scratch memory for drawing
+  std::vector<io_vec3_t> triangles, lines;
+
+  // Scratch memory for flood filling regions
+  std::vector<uint64_t> region_visited;
+  std::vector<io_u8vec3_t> region_seeds;
+
+  // Merges the exposed faces of the given entries of a single cell to
+  // rectangles (greedy meshing). Coplanar faces are only merged if they share
+  // the same palette index. Faces are never merged across cells, so the
+  // meshes of clean cells can be kept.
+  void build_cell_mesh(uint32_t cell, const uint32_t* cell_entries,
+                       uint32_t num_cell_entries, std::vector<uint32_t>& faces)
+  {
+    const auto& dim = cull_dim;
+    const uint32_t origin[3] = {(cell & 7u) * 32u, ((cell >> 3u) & 7u) * 32u,
+                                (cell >> 6u) * 32u};
+
+    auto& quads = cell_meshes[cell];
+    quads.clear();
+
+    // Sort the faces by direction and slice of the cell (counting sort)
+    constexpr uint32_t num_slices = 6u * 32u;
+    uint32_t slice_starts[num_slices + 1u] = {};
+
+    for (uint32_t i = 0u; i < num_cell_entries; ++i)
+    {
+      const auto& e = entries[cell_entries[i]];
+      uint8_t coord[3];
+      unpack(e.data, coord[0], coord[1], coord[2]);
+      if (e.face_flags == 0u ||
+          !is_coord_valid(io_u8vec3_t{coord[0], coord[1], coord[2]}, dim))
+        continue;
+
+      for (uint32_t f = 0u; f < 6u; ++f)
+      {
+        if (e.face_flags & (1u << f))
+          ++slice_starts[f * 32u + (coord[face_axis[f]] & 31u) + 1u];
+      }
+    }
+
+    for (uint32_t i = 0u; i < num_slices; ++i)
+      slice_starts[i + 1u] += slice_starts[i];
+
+    // Faces are stored as "u | v << 8 | palette index << 16" (in the cell)
+    faces.resize(slice_starts[num_slices]);
+    {
+      uint32_t offsets[num_slices];
+      memcpy(offsets, slice_starts, sizeof(offsets));
+
+      for (uint32_t i = 0u; i < num_cell_entries; ++i)
+      {
+        const auto& e = entries[cell_entries[i]];
+        uint8_t coord[3], palette_index;
+        unpack(e.data, coord[0], coord[1], coord[2], &palette_index);
+        if (e.face_flags == 0u ||
+            !is_coord_valid(io_u8vec3_t{coord[0], coord[1], coord[2]}, dim))
+          continue;
+
+        for (uint32_t f = 0u; f < 6u; ++f)
+        {
+          if ((e.face_flags & (1u << f)) == 0u)
+            continue;
+
+          const uint32_t a = face_axis[f];
+          faces[offsets[f * 32u + (coord[a] & 31u)]++] =
+              (coord[(a + 1u) % 3u] & 31u) |
+              (coord[(a + 2u) % 3u] & 31u) << 8u | palette_index << 16u;
+        }
+      }
+    }
+
+    // Merge the faces of each slice on a 32^2 grid of "palette index + 1"
+    // entries. Merged faces are cleared right away, so the grid is empty
+    // again after processing a slice
+    uint16_t grid[32u * 32u] = {};
+
+    for (uint32_t s = 0u; s < num_slices; ++s)
+    {
+      if (slice_starts[s] == slice_starts[s + 1u])
+        continue;
+
+      const uint32_t f = s / 32u, a = face_axis[f];
+      const uint32_t ua = (a + 1u) % 3u, va = (a + 2u) % 3u;
+
+      uint32_t min_u = 31u, min_v = 31u, max_u = 0u, max_v = 0u;
+      for (uint32_t i = slice_starts[s]; i < slice_starts[s + 1u]; ++i)
+      {
+        const uint32_t u = faces[i] & 0xFFu, v = (faces[i] >> 8u) & 0xFFu;
+        grid[u + v * 32u] = (uint16_t)((faces[i] >> 16u) + 1u);
+
+        min_u = std::min(min_u, u);
+        max_u = std::max(max_u, u);
+        min_v = std::min(min_v, v);
+        max_v = std::max(max_v, v);
+      }
+
+      for (uint32_t v = min_v; v <= max_v; ++v)
+      {
+        for (uint32_t u = min_u; u <= max_u; ++u)
+        {
+          uint16_t* row = &grid[v * 32u];
+          const uint16_t value = row[u];
+          if (value == 0u)
+            continue;
+
+          uint32_t w = 1u;
+          while (u + w <= max_u && row[u + w] == value)
+            ++w;
+
+          uint32_t h = 1u;
+          for (; v + h <= max_v; ++h)
+          {
+            const uint16_t* next_row = &row[h * 32u];
+            uint32_t i = 0u;
+            while (i < w && next_row[u + i] == value)
+              ++i;
+            if (i < w)
+              break;
+          }
+
+          for (uint32_t y = 0u; y < h; ++y)
+            memset(&row[y * 32u + u], 0, w * sizeof(uint16_t));
+
+          quads.push_back(
+              {(uint8_t)(origin[ua] + u), (uint8_t)(origin[va] + v),
+               (uint8_t)(w - 1u), (uint8_t)(h - 1u),
+               (uint8_t)(origin[a] + s % 32u), (uint8_t)f,
+               (uint8_t)(value - 1u)});
+
+          u += w - 1u;
+        }
+      }
+    }
+  }
+
+  // Gathers the meshes of all cells and sorts the quads by palette index
+  void build_mesh()
+  {
+    uint32_t num_quads[256] = {};
+    for (const auto& quads : cell_meshes)
+      for (const auto& q : quads)
+        ++num_quads[q.palette_index];
+
+    mesh_starts[0] = 0u;
+    for (uint32_t i = 0u; i < 256u; ++i)
+      mesh_starts[i + 1u] = mesh_starts[i] + num_quads[i];
+
+    mesh.resize(mesh_starts[256]);
+    {
+      uint32_t offsets[256];
+      memcpy(offsets, mesh_starts, sizeof(offsets));
+      for (const auto& quads : cell_meshes)
+        for (const auto& q : quads)
+          mesh[offsets[q.palette_index]++] = q;
+    }
+  }
 };
 
 //----------------------------------------------------------------------------//
@@ -712,7 +1737,94 @@ void timer_finalize(const char* title, uint32_t result)
 }
 
 //----------------------------------------------------------------------------//
-template <bool UseMorton, typename T>
+// The previous "std::vector<bool>" based occupancy mask, kept for comparison
+//----------------------------------------------------------------------------//
+template <bool UseMortonEncoding = false> struct legacy_occupancy_mask_t
+{
+  struct mask_t
+  {
+    inline mask_t() { data.resize(32768u); } // 32^3
+
+    std::vector<bool> data;
+  };
+
+  template <typename T> inline auto set(const T& coord, bool occupied) -> bool
+  {
+    auto* mask = get_mask(coord);
+    const auto mask_index = calc_mask_index(coord);
+
+    const bool was_occupied = mask->data[mask_index];
+    mask->data[mask_index] = occupied;
+
+    return was_occupied != occupied;
+  };
+
+  template <typename T> inline auto get(const T& coord) -> bool
+  {
+    auto* mask = get_mask<T, false>(coord);
+    if (nullptr == mask)
+      return false;
+    return mask->data[calc_mask_index(coord)];
+  };
+
+  inline auto count() -> uint32_t
+  {
+    uint32_t result = 0u;
+    for (const auto& c : cells)
+      for (bool v : c.data)
+        result += v;
+    return result;
+  }
+
+private:
+  template <typename T, bool Create = true>
+  inline auto get_mask(const T& coord) -> mask_t*
+  {
+    const auto cell_index = calc_cell_index(coord);
+    if constexpr (Create)
+    {
+      if (cell_index >= cells.size())
+        cells.resize(cell_index + 1u);
+    }
+    else
+    {
+      if (cell_index >= cells.size())
+        return nullptr;
+    }
+    return &cells[cell_index];
+  }
+
+  template <typename T>
+  inline static auto calc_cell_index(const T& coord) -> uint32_t
+  {
+    const io_uvec3_t coord_quant = {(uint32_t)coord.x >> 5u,
+                                    (uint32_t)coord.y >> 5u,
+                                    (uint32_t)coord.z >> 5u};
+    return coord_quant.x + (coord_quant.y << 3u) + (coord_quant.z << 6u);
+  }
+
+  template <typename T>
+  inline static auto calc_mask_index(const T& coord) -> uint32_t
+  {
+    if constexpr (UseMortonEncoding)
+    {
+      return morton::encode_5b(
+          io_uvec3_t{(uint32_t)coord.x, (uint32_t)coord.y, (uint32_t)coord.z});
+    }
+    else
+    {
+      const io_uvec3_t coord_mask = {(uint32_t)coord.x & 31u,
+                                     (uint32_t)coord.y & 31u,
+                                     (uint32_t)coord.z & 31u};
+      return coord_mask.x + (coord_mask.y << 5u) + (coord_mask.z << 10u);
+    }
+  }
+
+  std::vector<mask_t> cells;
+};
+
+//----------------------------------------------------------------------------//
+template <typename T>
 static auto occupancy_mask_test0(uint32_t size, T& mask) -> uint32_t
 {
   uint32_t result = 0u;
@@ -736,11 +1848,81 @@ static auto occupancy_mask_test0(uint32_t size, T& mask) -> uint32_t
   return result;
 }
 
+//----------------------------------------------------------------------------//
+static auto occupancy_mask_test0_batch(const std::vector<uint32_t>& coords,
+                                       std::vector<uint8_t>& results,
+                                       const sparse_occupancy_mask_t& mask)
+    -> uint32_t
+{
+  mask.get_batch(coords.data(), (uint32_t)coords.size(), results.data());
+
+  uint32_t result = 0u;
+  for (auto r : results)
+    result += r;
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+template <typename T>
+static auto occupancy_mask_test1(uint32_t size, T& mask) -> uint32_t
+{
+  uint32_t result = 0u;
+
+  // Count the exposed faces using six lookups per voxel
+  for (int32_t z = 0; z < (int32_t)size; ++z)
+    for (int32_t y = 0; y < (int32_t)size; ++y)
+      for (int32_t x = 0; x < (int32_t)size; ++x)
+      {
+        const auto is_set = [&mask](int32_t x, int32_t y, int32_t z) -> bool {
+          if (x < 0 || y < 0 || z < 0)
+            return false;
+          return mask.get(io_uvec3_t{(uint32_t)x, (uint32_t)y, (uint32_t)z});
+        };
+
+        if (!is_set(x, y, z))
+          continue;
+
+        result += !is_set(x, y, z + 1);
+        result += !is_set(x, y, z - 1);
+        result += !is_set(x, y + 1, z);
+        result += !is_set(x, y - 1, z);
+        result += !is_set(x - 1, y, z);
+        result += !is_set(x + 1, y, z);
+      }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+static auto occupancy_mask_test1_bricks(uint32_t size,
+                                        const sparse_occupancy_mask_t& mask)
+    -> uint32_t
+{
+  uint32_t result = 0u;
+
+  // Count the exposed faces using the brick masks
+  const int32_t num_bricks = size / 4u;
+  for (int32_t bz = 0; bz < num_bricks; ++bz)
+    for (int32_t by = 0; by < num_bricks; ++by)
+      for (int32_t bx = 0; bx < num_bricks; ++bx)
+      {
+        uint64_t faces[6];
+        mask.calc_exposed_faces(bx, by, bz, faces);
+
+        for (uint32_t i = 0u; i < 6u; ++i)
+          result += (uint32_t)_mm_popcnt_u64(faces[i]);
+      }
+
+  return result;
+}
+
 //----------------------------------------------------------------------------//
 void occupancy_mask()
 {
-  sparse_occupancy_mask_t<true> mask_morton;
-  sparse_occupancy_mask_t<false> mask_linear;
+  legacy_occupancy_mask_t<true> mask_morton;
+  legacy_occupancy_mask_t<false> mask_linear;
+  sparse_occupancy_mask_t mask_bricks;
 
   constexpr uint32_t size = 64u;
   constexpr uint32_t num_samples = 10u;
@@ -751,23 +1933,89 @@ void occupancy_mask()
       {
         mask_morton.set(io_uvec3_t{x, y, z}, true);
         mask_linear.set(io_uvec3_t{x, y, z}, true);
+        mask_bricks.set(io_uvec3_t{x, y, z}, true);
+      }
+
+  // Packed coordinates for the batched queries, same pattern as test 0
+  std::vector<uint32_t> coords;
+  {
+    const uint32_t num_voxels = size * size * size;
+    for (uint32_t i = 0u; i < num_voxels; i += 8u)
+    {
+      const auto c = morton::decode_8b(i);
+      for (uint32_t j = 0u; j < 8u; ++j)
+      {
+        coords.push_back(sparse_volume_t::pack(
+            c.x + (j & 1u), c.y + ((j >> 1u) & 1u), c.z + ((j >> 2u) & 1u),
+            0u));
       }
+    }
+  }
+  std::vector<uint8_t> results(coords.size());
 
   uint32_t result;
   for (uint32_t i = 0u; i < num_samples; ++i)
   {
     timer_sample_start();
-    result = occupancy_mask_test0<true>(size, mask_morton);
+    result = occupancy_mask_test0(size, mask_morton);
+    timer_sample_end();
+  }
+  timer_finalize("Get (Morton)", result);
+
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = occupancy_mask_test0(size, mask_linear);
+    timer_sample_end();
+  }
+  timer_finalize("Get (Linear)", result);
+
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = occupancy_mask_test0(size, mask_bricks);
+    timer_sample_end();
+  }
+  timer_finalize("Get (Bricks)", result);
+
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = occupancy_mask_test0_batch(coords, results, mask_bricks);
+    timer_sample_end();
+  }
+  timer_finalize("Get (Bricks, Batched)", result);
+
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = occupancy_mask_test1(size, mask_linear);
+    timer_sample_end();
+  }
+  timer_finalize("Faces (Linear)", result);
+
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = occupancy_mask_test1_bricks(size, mask_bricks);
+    timer_sample_end();
+  }
+  timer_finalize("Faces (Bricks)", result);
+
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = mask_linear.count();
     timer_sample_end();
   }
-  timer_finalize("Morton", result);
+  timer_finalize("Count (Linear)", result);
 
   for (uint32_t i = 0u; i < num_samples; ++i)
   {
     timer_sample_start();
-    result = occupancy_mask_test0<false>(size, mask_linear);
+    result = mask_bricks.count();
     timer_sample_end();
   }
-  timer_finalize("Linear", result);
+  timer_finalize("Count (Bricks)", result);
 }
 } // namespace benchmark
\ No newline at end of file
@@ -0,0 +1,467 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "sparse_volume.h"
+#include "voxel_raycast.h"
+
+// STL
+#include <algorithm>
+#include <deque>
+
+//----------------------------------------------------------------------------//
+// Journal of sparse changes to the voxel data of shapes. Each change stores
+// the old and the new value of all modified voxels, run-length encoded along
+// the linear voxel index (and thus along x). The memory used by the journal is
+// bounded, the oldest changes are dropped first.
+struct undo_journal_t
+{
+  // Applies the given volume to the shape and records the change. Only the
+  // bounds of the modified voxels are voxelized. Returns false if no voxel
+  // changed.
+  auto apply(io_ref_t shape, const sparse_volume_t& volume, const char* name)
+      -> bool
+  {
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    const auto dim = io_component_voxel_shape->get_dim(shape);
+
+    change_t change = {shape, dim, name};
+    if (!record(data, volume, scratch, change))
+      return false;
+
+    common::voxelize(shape, change.bounds);
+    voxel_raycaster.invalidate(shape, change.bounds);
+    ++revision;
+    change.group = next_group++;
+    push(std::move(change));
+
+    return true;
+  }
+
+  struct shape_delta_t
+  {
+    io_ref_t shape;
+    const sparse_volume_t* volume;
+    bool changed; // Set by "apply"
+  };
+
+  // Applies the given volumes to their shapes concurrently and records the
+  // changes as a single step. Returns false if no voxel changed.
+  auto apply(std::vector<shape_delta_t>& deltas, const char* name) -> bool
+  {
+    if (deltas.empty())
+      return false;
+
+    std::vector<change_t> group_changes(deltas.size());
+    for (uint32_t i = 0u; i < deltas.size(); ++i)
+    {
+      const auto shape = deltas[i].shape;
+      group_changes[i] = {shape, io_component_voxel_shape->get_dim(shape),
+                          name};
+    }
+
+    apply_task_t task;
+    io_init_scheduler_task(&task, (uint32_t)deltas.size(),
+                           apply_task_t::execute);
+    task.target_num_sub_tasks_per_worker = 2u;
+    task.deltas = deltas.data();
+    task.changes = group_changes.data();
+    for (const auto& d : deltas)
+      task.data.push_back(io_component_voxel_shape->get_voxel_data(d.shape));
+
+    io_base->scheduler_enqueue_task(&task);
+    io_base->scheduler_wait_for_task(&task);
+
+    const uint32_t group = next_group++;
+    bool changed = false;
+    for (uint32_t i = 0u; i < deltas.size(); ++i)
+    {
+      auto& change = group_changes[i];
+      deltas[i].changed = !change.runs.empty();
+      if (!deltas[i].changed)
+        continue;
+
+      common::voxelize(change.shape, change.bounds);
+      voxel_raycaster.invalidate(change.shape, change.bounds);
+      change.group = group;
+      push(std::move(change));
+      changed = true;
+    }
+
+    ++revision;
+    return changed;
+  }
+
+  // Has to be called before modifying the voxel data of the given shape
+  // directly, e.g., for global operations. Either pushes a snapshot to the
+  // undo/redo stack of the engine or prepares recording the change.
+  void begin_global_op(io_ref_t shape, const char* name)
+  {
+    if (use_engine_snapshots_for_global_ops)
+    {
+      io_editor->push_undo_redo_state_for_entity(
+          name, io_component_voxel_shape->base.get_entity(shape), false);
+      global_op_shape = io_ref_invalid();
+      return;
+    }
+
+    const auto dim = io_component_voxel_shape->get_dim(shape);
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    global_op_data.assign(data, data + (size_t)dim.x * dim.y * dim.z);
+    global_op_shape = shape;
+    global_op_name = name;
+  }
+
+  // Records the changes since the last call to "begin_global_op"
+  void end_global_op(io_ref_t shape)
+  {
+    voxel_raycaster.invalidate(shape);
+    ++revision;
+
+    if (!io_ref_is_equal(global_op_shape, shape))
+      return;
+    global_op_shape = io_ref_invalid();
+
+    const auto dim = io_component_voxel_shape->get_dim(shape);
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    const uint32_t num_voxels = (uint32_t)global_op_data.size();
+    if ((size_t)dim.x * dim.y * dim.z != num_voxels)
+      return;
+
+    // Global operations touch the whole shape
+    change_t change = {shape, dim, global_op_name};
+    change.bounds.add(0, 0, 0);
+    change.bounds.add(dim.x - 1, dim.y - 1, dim.z - 1);
+
+    // Skip unchanged blocks of 32 voxels
+    uint32_t i = 0u;
+    for (; i + 32u <= num_voxels; i += 32u)
+    {
+      const __m256i a = _mm256_loadu_si256((const __m256i*)&data[i]);
+      const __m256i b =
+          _mm256_loadu_si256((const __m256i*)&global_op_data[i]);
+      uint32_t changed =
+          ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+      while (changed)
+      {
+        const uint32_t j = i + std::countr_zero(changed);
+        changed &= changed - 1u;
+        append(change.runs, j, global_op_data[j], data[j]);
+      }
+    }
+
+    for (; i < num_voxels; ++i)
+    {
+      if (data[i] != global_op_data[i])
+        append(change.runs, i, global_op_data[i], data[i]);
+    }
+
+    global_op_data.clear();
+    global_op_data.shrink_to_fit();
+
+    change.group = next_group++;
+    push(std::move(change));
+  }
+
+  // Reverts the last change (or group of changes). Returns false if there is
+  // nothing to undo or if the voxel data has been modified by other means
+  // since. The journal is cleared in the latter case.
+  auto undo() -> bool
+  {
+    if (!can_undo())
+      return false;
+
+    const uint32_t group = changes[num_applied_changes - 1u].group;
+    uint32_t first = num_applied_changes - 1u;
+    while (first > 0u && changes[first - 1u].group == group)
+      --first;
+
+    // Check the whole group first, so it is never reverted partially
+    for (uint32_t i = first; i < num_applied_changes; ++i)
+    {
+      if (!can_apply_change(changes[i], true))
+      {
+        clear();
+        return false;
+      }
+    }
+
+    for (uint32_t i = num_applied_changes; i > first; --i)
+      apply_change(changes[i - 1u], true);
+    num_applied_changes = first;
+
+    return true;
+  }
+
+  // Reapplies the last reverted change (or group of changes). See "undo".
+  auto redo() -> bool
+  {
+    if (!can_redo())
+      return false;
+
+    const uint32_t group = changes[num_applied_changes].group;
+    uint32_t last = num_applied_changes + 1u;
+    while (last < changes.size() && changes[last].group == group)
+      ++last;
+
+    // Check the whole group first, so it is never reapplied partially
+    for (uint32_t i = num_applied_changes; i < last; ++i)
+    {
+      if (!can_apply_change(changes[i], false))
+      {
+        clear();
+        return false;
+      }
+    }
+
+    for (uint32_t i = num_applied_changes; i < last; ++i)
+      apply_change(changes[i], false);
+    num_applied_changes = last;
+
+    return true;
+  }
+
+  inline auto can_undo() const -> bool { return num_applied_changes > 0u; }
+  inline auto can_redo() const -> bool
+  {
+    return num_applied_changes < changes.size();
+  }
+
+  inline auto get_undo_name() const -> const char*
+  {
+    return can_undo() ? changes[num_applied_changes - 1u].name : nullptr;
+  }
+  inline auto get_redo_name() const -> const char*
+  {
+    return can_redo() ? changes[num_applied_changes].name : nullptr;
+  }
+
+  // Incremented whenever voxel data is modified via the journal
+  inline auto get_revision() const -> uint32_t { return revision; }
+
+  void clear()
+  {
+    changes.clear();
+    num_applied_changes = 0u;
+    memory_usage = 0u;
+  }
+
+  // Upper bound for the memory used by the recorded changes
+  size_t memory_budget = 256ull * 1024ull * 1024ull;
+  // Use the snapshots of the engine for global operations instead. Off by
+  // default so that all voxel edits end up in a single history
+  bool use_engine_snapshots_for_global_ops = false;
+
+private:
+  // Voxels [index, index + length_minus_one] changed from "old_value" to
+  // "new_value"
+  struct run_t
+  {
+    uint32_t index;
+    uint16_t length_minus_one;
+    uint8_t old_value;
+    uint8_t new_value;
+  };
+
+  struct change_t
+  {
+    io_ref_t shape;
+    io_u16vec3_t dim;
+    const char* name;
+    std::vector<run_t> runs;
+    voxel_aabb_t bounds;
+    uint32_t group; // Changes of the same group are undone as a whole
+  };
+
+  // Writes the given volume to the voxel data and records the modified voxels
+  // in the given change. Returns false if no voxel changed.
+  static auto record(uint8_t* data, const sparse_volume_t& volume,
+                     std::vector<uint64_t>& scratch, change_t& change) -> bool
+  {
+    const auto dim = change.dim;
+
+    // Gather the modified voxels as "index << 16 | old << 8 | new"
+    scratch.clear();
+    for (const auto& e : volume.entries)
+    {
+      io_u8vec3_t coord;
+      uint8_t value;
+      sparse_volume_t::unpack(e.data, coord.x, coord.y, coord.z, &value);
+
+      if (!sparse_volume_t::is_coord_valid(coord, dim))
+        continue;
+
+      const uint32_t index =
+          coord.x + coord.y * dim.x + coord.z * dim.x * dim.y;
+      if (data[index] != value)
+      {
+        scratch.push_back((uint64_t)index << 16u |
+                          (uint64_t)data[index] << 8u | value);
+        change.bounds.add(coord.x, coord.y, coord.z);
+      }
+    }
+
+    if (scratch.empty())
+      return false;
+    std::sort(scratch.begin(), scratch.end());
+
+    for (uint64_t s : scratch)
+    {
+      const uint32_t index = (uint32_t)(s >> 16u);
+      data[index] = s & 0xFFu;
+      append(change.runs, index, (s >> 8u) & 0xFFu, s & 0xFFu);
+    }
+
+    return true;
+  }
+
+  // Records and applies one shape delta per workload
+  struct apply_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      const auto task = (const apply_task_t*)task_;
+
+      std::vector<uint64_t> scratch;
+      for (uint32_t i = range.x; i < range.y; ++i)
+        record(task->data[i], *task->deltas[i].volume, scratch,
+               task->changes[i]);
+    }
+
+    const shape_delta_t* deltas;
+    change_t* changes;
+    std::vector<uint8_t*> data;
+  };
+
+  inline static void append(std::vector<run_t>& runs, uint32_t index,
+                            uint8_t old_value, uint8_t new_value)
+  {
+    if (!runs.empty())
+    {
+      auto& r = runs.back();
+      if (r.index + r.length_minus_one + 1u == index &&
+          r.old_value == old_value && r.new_value == new_value &&
+          r.length_minus_one < 0xFFFFu)
+      {
+        ++r.length_minus_one;
+        return;
+      }
+    }
+
+    runs.push_back({index, 0u, old_value, new_value});
+  }
+
+  inline static auto calc_memory_usage(const change_t& change) -> size_t
+  {
+    return sizeof(change_t) + change.runs.capacity() * sizeof(run_t);
+  }
+
+  void push(change_t&& change)
+  {
+    if (change.runs.empty())
+      return;
+    change.runs.shrink_to_fit();
+
+    // Drop the changes which can no longer be redone
+    while (changes.size() > num_applied_changes)
+    {
+      memory_usage -= calc_memory_usage(changes.back());
+      changes.pop_back();
+    }
+
+    memory_usage += calc_memory_usage(change);
+    changes.push_back(std::move(change));
+    ++num_applied_changes;
+
+    // Always keep the latest group of changes
+    while (memory_usage > memory_budget &&
+           changes.front().group != changes.back().group)
+    {
+      memory_usage -= calc_memory_usage(changes.front());
+      changes.pop_front();
+      --num_applied_changes;
+    }
+  }
+
+  // Returns true if the shape of the change still holds the voxels the change
+  // is reverted (or reapplied) from
+  auto can_apply_change(const change_t& change, bool undo) const -> bool
+  {
+    const auto shape = change.shape;
+    if (!io_component_voxel_shape->base.is_alive(shape))
+      return false;
+
+    const auto dim = io_component_voxel_shape->get_dim(shape);
+    if (dim.x != change.dim.x || dim.y != change.dim.y ||
+        dim.z != change.dim.z)
+      return false;
+
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    for (const auto& r : change.runs)
+    {
+      const uint8_t expected = undo ? r.new_value : r.old_value;
+      for (uint32_t i = r.index; i <= r.index + r.length_minus_one; ++i)
+      {
+        if (data[i] != expected)
+          return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Reverts (or reapplies) the change. Has to be checked via
+  // "can_apply_change" first.
+  void apply_change(const change_t& change, bool undo)
+  {
+    const auto shape = change.shape;
+    const auto data = io_component_voxel_shape->get_voxel_data(shape);
+    for (const auto& r : change.runs)
+      memset(&data[r.index], undo ? r.old_value : r.new_value,
+             r.length_minus_one + 1u);
+
+    io_component_voxel_shape->commit_snapshot(shape);
+    common::voxelize(shape, change.bounds);
+    voxel_raycaster.invalidate(shape, change.bounds);
+    ++revision;
+  }
+
+  std::deque<change_t> changes;
+  uint32_t num_applied_changes = 0u;
+  size_t memory_usage = 0u;
+  uint32_t next_group = 0u;
+  uint32_t revision = 0u;
+
+  // State of the global operation in flight
+  std::vector<uint8_t> global_op_data;
+  io_ref_t global_op_shape = io_ref_invalid();
+  const char* global_op_name = nullptr;
+
+  std::vector<uint64_t> scratch;
+};
+
+//----------------------------------------------------------------------------//
+static undo_journal_t undo_journal;
@@ -26,9 +26,12 @@
 //----------------------------------------------------------------------------//
 static void on_tick_edit_tool(io_float32_t delta_t)
 {
+  voxel_raycaster.begin_frame();
   editing_ui::show_editing_toolbar();
   editing_tools::handle_tool(editing_ui::current_tool_params);
   // benchmark::occupancy_mask();
+  // benchmark::raycast(io_component_voxel_shape->base.get_component_for_entity(
+  //     io_editor->get_first_selected_entity()));
 }
 
 //----------------------------------------------------------------------------//
@@ -46,6 +49,9 @@ IO_API_EXPORT int IO_API_CALL load_plugin(void* api_manager)
         (const io_logging_i*)io_api_manager->find_first(IO_LOGGING_API_NAME);
     io_editor =
         (const io_editor_i*)io_api_manager->find_first(IO_EDITOR_API_NAME);
+    io_editor_selection =
+        (const io_editor_selection_i*)io_api_manager->find_first(
+            IO_EDITOR_SELECTION_API_NAME);
     io_world = (const io_world_i*)io_api_manager->find_first(IO_WORLD_API_NAME);
     io_debug_geometry = (const io_debug_geometry_i*)io_api_manager->find_first(
         IO_DEBUG_GEOMETRY_API_NAME);
@@ -56,6 +62,12 @@ IO_API_EXPORT int IO_API_CALL load_plugin(void* api_manager)
     io_component_voxel_shape =
         (const io_component_voxel_shape_i*)io_api_manager->find_first(
             IO_COMPONENT_VOXEL_SHAPE_API_NAME);
+    io_component_camera =
+        (const io_component_camera_i*)io_api_manager->find_first(
+            IO_COMPONENT_CAMERA_API_NAME);
+    io_component_voxel_shape_region =
+        (const io_component_voxel_shape_region_i*)io_api_manager->find_first(
+            IO_COMPONENT_VOXEL_SHAPE_REGION_API_NAME);
     io_resource_palette =
         (const io_resource_palette_i*)io_api_manager->find_first(
             IO_RESOURCE_PALETTE_API_NAME);
@@ -94,5 +106,6 @@ IO_API_EXPORT int IO_API_CALL load_plugin(void* api_manager)
 //----------------------------------------------------------------------------//
 IO_API_EXPORT void IO_API_CALL unload_plugin()
 {
+  shape_analysis.wait();
   io_api_manager->unregister_api(&io_user_editor_tool);
 }
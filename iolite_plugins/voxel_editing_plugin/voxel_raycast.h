@@ -0,0 +1,557 @@
+// MIT License
+//
+// Copyright (c) 2023 Missing Deadlines (Benjamin Wrensch)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "sparse_volume.h"
+
+// STL
+#include <cfloat>
+
+//----------------------------------------------------------------------------//
+// Traces rays directly against the voxel data of shapes. Empty space is
+// skipped using an occupancy pyramid with one flag per brick (4^3 voxels) and
+// one flag per cell (16^3 voxels). A pyramid is cached for each of the most
+// recently traced shapes.
+struct voxel_raycaster_t
+{
+  struct hit_t
+  {
+    float distance;    // In units of the ray direction
+    glm::ivec3 coord;  // The voxel hit
+    glm::ivec3 normal; // The normal of the face hit (in voxel space)
+  };
+
+  // Occupancy pyramid of a single shape
+  struct pyramid_t
+  {
+    // Traces a ray in the voxel space of the shape (voxel x covers
+    // [x, x + 1)). Returns true if a solid voxel is hit within the given
+    // distance.
+    auto raycast_local(glm::vec3 origin, glm::vec3 dir, float max_distance,
+                       hit_t& hit) const -> bool
+    {
+      if (!data)
+        return false;
+
+      glm::ivec3 step;
+      glm::vec3 inv_dir;
+      for (uint32_t i = 0u; i < 3u; ++i)
+      {
+        step[i] = dir[i] > 0.0f ? 1 : (dir[i] < 0.0f ? -1 : 0);
+        inv_dir[i] = step[i] != 0 ? 1.0f / dir[i] : 0.0f;
+      }
+
+      // Clip the ray against the bounds of the shape
+      float t = 0.0f, t_max = max_distance;
+      int32_t axis = -1;
+      for (uint32_t i = 0u; i < 3u; ++i)
+      {
+        if (step[i] == 0)
+        {
+          if (origin[i] < 0.0f || origin[i] >= (float)dim[i])
+            return false;
+          continue;
+        }
+
+        float t0 = -origin[i] * inv_dir[i];
+        float t1 = ((float)dim[i] - origin[i]) * inv_dir[i];
+        if (t0 > t1)
+          std::swap(t0, t1);
+
+        if (t0 > t)
+        {
+          t = t0;
+          axis = i;
+        }
+        t_max = glm::min(t_max, t1);
+      }
+
+      if (t > t_max)
+        return false;
+
+      glm::ivec3 coord;
+      for (uint32_t i = 0u; i < 3u; ++i)
+        coord[i] = glm::clamp((int32_t)glm::floor(origin[i] + dir[i] * t), 0,
+                              dim[i] - 1);
+      if (axis != -1)
+        coord[axis] = step[axis] > 0 ? 0 : dim[axis] - 1;
+
+      while (true)
+      {
+        // Skip the largest empty block containing the voxel
+        uint32_t shift = 0u;
+        if (!cells[calc_cell_index(coord >> 4)])
+          shift = 4u;
+        else if (!bricks[calc_brick_index(coord >> 2)])
+          shift = 2u;
+        else if (data[coord.x + coord.y * dim.x + coord.z * dim.x * dim.y])
+        {
+          if (axis == -1)
+          {
+            // Started inside a solid voxel; face the ray
+            const glm::vec3 a = glm::abs(dir);
+            axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+          }
+
+          hit.distance = t;
+          hit.coord = coord;
+          hit.normal = glm::ivec3(0);
+          hit.normal[axis] = -step[axis];
+
+          return true;
+        }
+
+        // Advance to the block the ray enters next
+        const int32_t size = 1 << shift;
+        const glm::ivec3 block_min =
+            (coord >> (int32_t)shift) << (int32_t)shift;
+
+        float t_exit = FLT_MAX;
+        int32_t exit_axis = -1;
+        for (uint32_t i = 0u; i < 3u; ++i)
+        {
+          if (step[i] == 0)
+            continue;
+
+          const int32_t boundary =
+              step[i] > 0 ? block_min[i] + size : block_min[i];
+          const float t_i = ((float)boundary - origin[i]) * inv_dir[i];
+          if (t_i < t_exit)
+          {
+            t_exit = t_i;
+            exit_axis = i;
+          }
+        }
+
+        if (exit_axis == -1 || t_exit > t_max)
+          return false;
+
+        for (uint32_t i = 0u; i < 3u; ++i)
+        {
+          if (i == (uint32_t)exit_axis)
+            continue;
+
+          // Stay within the current block to guarantee progress
+          coord[i] =
+              glm::clamp((int32_t)glm::floor(origin[i] + dir[i] * t_exit),
+                         glm::max(block_min[i], 0),
+                         glm::min(block_min[i] + size, dim[i]) - 1);
+        }
+
+        coord[exit_axis] = step[exit_axis] > 0 ? block_min[exit_axis] + size
+                                               : block_min[exit_axis] - 1;
+        if (coord[exit_axis] < 0 || coord[exit_axis] >= dim[exit_axis])
+          return false;
+
+        t = glm::max(t, t_exit);
+        axis = exit_axis;
+      }
+    }
+
+    inline auto calc_brick_index(glm::ivec3 b) const -> uint32_t
+    {
+      return b.x + b.y * brick_dim.x + b.z * brick_dim.x * brick_dim.y;
+    }
+
+    inline auto calc_cell_index(glm::ivec3 c) const -> uint32_t
+    {
+      return c.x + c.y * cell_dim.x + c.z * cell_dim.x * cell_dim.y;
+    }
+
+    io_ref_t shape{};
+    const uint8_t* data{nullptr};
+    glm::ivec3 dim{0}, brick_dim{0}, cell_dim{0};
+    bool valid{false};
+
+    // Layers of bricks (along z) which have to be gathered again
+    int32_t dirty_begin{0}, dirty_end{0};
+    // Next layer of bricks to verify (see "begin_frame")
+    int32_t next_verified_layer{0};
+    uint32_t last_used_frame{0u}, last_edit_frame{0u};
+
+    std::vector<uint8_t> bricks;
+    std::vector<uint8_t> cells;
+  };
+
+  // Traces a ray in world space against the given shape. Mirrors
+  // "io_component_voxel_shape_i::raycast". The result is optional.
+  auto raycast(io_ref_t shape, io_vec3_t origin, io_vec3_t direction,
+               float distance,
+               io_component_voxel_shape_raycast_result_t* result) -> bool
+  {
+    const auto& pyramid = update(shape);
+
+    // The transform from world to voxel space is affine, so the ray can be
+    // transformed as a whole
+    const glm::vec3 dir_ws = glm::normalize(glm::vec3(io_cvt(direction)));
+    const glm::vec3 origin_vs =
+        io_cvt(io_component_voxel_shape->to_local_space(shape, origin));
+    const glm::vec3 dir_vs =
+        glm::vec3(io_cvt(io_component_voxel_shape->to_local_space(
+            shape, io_cvt(glm::vec3(io_cvt(origin)) + dir_ws)))) -
+        origin_vs;
+
+    hit_t hit;
+    if (!pyramid.raycast_local(origin_vs, dir_vs, distance, hit))
+      return false;
+
+    if (result)
+    {
+      const glm::vec3 normal_local = glm::vec3(hit.normal);
+      const glm::vec3 normal =
+          glm::vec3(io_cvt(io_component_voxel_shape->to_world_space(
+              shape, io_cvt(normal_local)))) -
+          glm::vec3(io_cvt(io_component_voxel_shape->to_world_space(
+              shape, io_cvt(glm::vec3(0.0f)))));
+
+      result->distance = hit.distance;
+      result->normal = io_cvt(glm::normalize(normal));
+      result->normal_local = io_cvt(normal_local);
+      result->shape = shape;
+      result->coord = {(uint8_t)hit.coord.x, (uint8_t)hit.coord.y,
+                       (uint8_t)hit.coord.z};
+    }
+
+    return true;
+  }
+
+  // Returns the pyramid of the given shape. Layers of bricks marked as dirty
+  // are gathered again, the whole pyramid is only rebuilt if the voxel data
+  // has been reallocated or resized.
+  auto update(io_ref_t shape) -> const pyramid_t&
+  {
+    auto& p = find_or_add(shape);
+    p.last_used_frame = frame;
+
+    const auto shape_data = io_component_voxel_shape->get_voxel_data(shape);
+    const auto shape_dim =
+        glm::ivec3(io_cvt(io_component_voxel_shape->get_dim(shape)));
+
+    if (!p.valid || p.data != shape_data || p.dim != shape_dim)
+    {
+      p.data = shape_data;
+      p.dim = shape_dim;
+      p.brick_dim = (p.dim + 3) >> 2;
+      p.cell_dim = (p.dim + 15) >> 4;
+      p.valid = true;
+
+      p.bricks.assign((size_t)p.brick_dim.x * p.brick_dim.y * p.brick_dim.z,
+                      0u);
+      p.cells.assign((size_t)p.cell_dim.x * p.cell_dim.y * p.cell_dim.z, 0u);
+      p.next_verified_layer = 0;
+      mark_layers_dirty(p, 0, p.brick_dim.z);
+    }
+
+    if (p.dirty_begin < p.dirty_end)
+      gather(p, p.dirty_begin, p.dirty_end);
+
+    return p;
+  }
+
+  // Has to be called once per frame. Edits to the voxel data made outside of
+  // the plugin (engine undo/redo, scripts, other plugins, ...) are not
+  // reported, so shapes with pending voxelizations are rebuilt and a few
+  // layers of bricks of every cached pyramid are gathered again each frame.
+  // Pyramids of destroyed shapes are dropped.
+  void begin_frame()
+  {
+    ++frame;
+
+    for (uint32_t i = 0u; i < (uint32_t)pyramids.size();)
+    {
+      auto& p = pyramids[i];
+      if (!io_component_voxel_shape->base.is_alive(p.shape))
+      {
+        pyramids[i] = std::move(pyramids.back());
+        pyramids.pop_back();
+        continue;
+      }
+      ++i;
+
+      if (!p.valid)
+        continue;
+
+      // Voxelizations queued by the plugin itself are covered by "invalidate"
+      if (p.last_edit_frame + 1u < frame &&
+          io_component_voxel_shape->is_voxelization_pending(p.shape))
+      {
+        mark_layers_dirty(p, 0, p.brick_dim.z);
+        continue;
+      }
+
+      const int32_t begin = p.next_verified_layer;
+      const int32_t end =
+          glm::min(begin + (int32_t)num_verified_layers_per_frame,
+                   p.brick_dim.z);
+      mark_layers_dirty(p, begin, end);
+      p.next_verified_layer = end < p.brick_dim.z ? end : 0;
+    }
+  }
+
+  // Has to be called after modifying the voxel data of the given region of the
+  // shape
+  inline void invalidate(io_ref_t shape, const voxel_aabb_t& region)
+  {
+    auto p = find(shape);
+    if (!p || !p->valid || region.empty())
+      return;
+
+    p->last_edit_frame = frame;
+    mark_layers_dirty(*p, glm::max(region.min.z, 0) >> 2,
+                      (glm::min(region.max.z, p->dim.z - 1) >> 2) + 1);
+  }
+
+  // Has to be called after modifying the voxel data of the given shape
+  inline void invalidate(io_ref_t shape)
+  {
+    auto p = find(shape);
+    if (!p)
+      return;
+
+    p->last_edit_frame = frame;
+    p->valid = false;
+  }
+
+  // Drops the pyramids of all shapes
+  inline void invalidate() { pyramids.clear(); }
+
+private:
+  // Maximum number of cached pyramids; the least recently used one is evicted
+  static constexpr uint32_t max_num_pyramids = 8u;
+  // Layers of bricks verified per pyramid and frame (16 voxels along z)
+  static constexpr uint32_t num_verified_layers_per_frame = 4u;
+  // Below this number of layers of bricks, gathering runs on the calling
+  // thread
+  static constexpr uint32_t min_num_layers_per_task = 4u;
+
+  // Gathers the occupancy of one layer of bricks per workload
+  struct occupancy_task_t : public io_scheduler_task_t
+  {
+    static void execute(io_uvec2_t range, uint32_t thread_id,
+                        uint32_t sub_task_index, void* task_)
+    {
+      const auto task = (const occupancy_task_t*)task_;
+      auto& r = *task->pyramid;
+      const __m256i zero = _mm256_setzero_si256();
+
+      for (int32_t bz = task->first_layer + (int32_t)range.x;
+           bz < task->first_layer + (int32_t)range.y; ++bz)
+      {
+        const int32_t z_end = glm::min((int32_t)bz * 4 + 4, r.dim.z);
+        for (int32_t z = bz * 4; z < z_end; ++z)
+          for (int32_t y = 0; y < r.dim.y; ++y)
+          {
+            const uint8_t* row = &r.data[(y + z * r.dim.y) * r.dim.x];
+            uint8_t* brick_row =
+                &r.bricks[(y >> 2) * r.brick_dim.x +
+                          bz * r.brick_dim.x * r.brick_dim.y];
+
+            // 32 voxels (eight bricks) at a time
+            int32_t x = 0;
+            for (; x + 32 <= r.dim.x; x += 32)
+            {
+              const uint32_t solid = ~(uint32_t)_mm256_movemask_epi8(
+                  _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&row[x]),
+                                    zero));
+              if (!solid)
+                continue;
+
+              for (uint32_t k = 0u; k < 8u; ++k)
+                brick_row[(x >> 2) + k] |= ((solid >> (k * 4u)) & 0xFu) != 0u;
+            }
+
+            for (; x < r.dim.x; ++x)
+              brick_row[x >> 2] |= row[x] != 0u;
+          }
+      }
+    }
+
+    pyramid_t* pyramid;
+    int32_t first_layer;
+  };
+
+  inline auto find(io_ref_t shape) -> pyramid_t*
+  {
+    for (auto& p : pyramids)
+    {
+      if (io_ref_is_equal(p.shape, shape))
+        return &p;
+    }
+    return nullptr;
+  }
+
+  inline auto find_or_add(io_ref_t shape) -> pyramid_t&
+  {
+    if (auto p = find(shape))
+      return *p;
+
+    if (pyramids.size() < max_num_pyramids)
+      pyramids.emplace_back();
+    else
+    {
+      // Reuse the memory of the least recently used pyramid
+      auto lru = &pyramids.front();
+      for (auto& p : pyramids)
+      {
+        if (p.last_used_frame < lru->last_used_frame)
+          lru = &p;
+      }
+      std::swap(*lru, pyramids.back());
+    }
+
+    auto& p = pyramids.back();
+    p.shape = shape;
+    p.valid = false;
+    p.last_edit_frame = 0u;
+    return p;
+  }
+
+  inline static void mark_layers_dirty(pyramid_t& p, int32_t begin,
+                                       int32_t end)
+  {
+    if (begin >= end)
+      return;
+
+    if (p.dirty_begin < p.dirty_end)
+    {
+      p.dirty_begin = glm::min(p.dirty_begin, begin);
+      p.dirty_end = glm::max(p.dirty_end, end);
+    }
+    else
+    {
+      p.dirty_begin = begin;
+      p.dirty_end = end;
+    }
+  }
+
+  // Gathers the occupancy of the given layers of bricks and updates the cells
+  // covering them
+  void gather(pyramid_t& p, int32_t begin, int32_t end)
+  {
+    p.dirty_begin = p.dirty_end = 0;
+
+    const size_t layer_size = (size_t)p.brick_dim.x * p.brick_dim.y;
+    memset(&p.bricks[begin * layer_size], 0, (end - begin) * layer_size);
+
+    occupancy_task_t task;
+    io_init_scheduler_task(&task, end - begin, occupancy_task_t::execute);
+    task.pyramid = &p;
+    task.first_layer = begin;
+
+    // Not worth the overhead for a few layers
+    if (end - begin > (int32_t)min_num_layers_per_task)
+    {
+      io_base->scheduler_enqueue_task(&task);
+      io_base->scheduler_wait_for_task(&task);
+    }
+    else
+      occupancy_task_t::execute({0u, (uint32_t)(end - begin)}, 0u, 0u, &task);
+
+    const int32_t cz_begin = begin >> 2, cz_end = (end + 3) >> 2;
+    for (int32_t cz = cz_begin; cz < cz_end; ++cz)
+    {
+      memset(&p.cells[p.calc_cell_index({0, 0, cz})], 0,
+             (size_t)p.cell_dim.x * p.cell_dim.y);
+
+      const int32_t bz_end = glm::min(cz * 4 + 4, p.brick_dim.z);
+      for (int32_t bz = cz * 4; bz < bz_end; ++bz)
+        for (int32_t by = 0; by < p.brick_dim.y; ++by)
+          for (int32_t bx = 0; bx < p.brick_dim.x; ++bx)
+          {
+            if (p.bricks[p.calc_brick_index({bx, by, bz})])
+              p.cells[p.calc_cell_index(glm::ivec3(bx, by, bz) >> 2)] = 1u;
+          }
+    }
+  }
+
+  std::vector<pyramid_t> pyramids;
+  uint32_t frame{1u};
+};
+
+//----------------------------------------------------------------------------//
+static voxel_raycaster_t voxel_raycaster;
+
+//----------------------------------------------------------------------------//
+namespace benchmark
+{
+
+//----------------------------------------------------------------------------//
+// Compares the plugin raycaster with the API raycast using random rays aimed
+// at the given shape
+void raycast(io_ref_t shape)
+{
+  constexpr uint32_t num_rays = 4096u;
+  constexpr uint32_t num_samples = 10u;
+
+  const glm::vec3 dim =
+      glm::vec3(io_cvt(io_component_voxel_shape->get_dim(shape)));
+  const float radius = glm::length(dim);
+
+  std::vector<io_vec3_t> origins(num_rays), directions(num_rays);
+  for (uint32_t i = 0u; i < num_rays; ++i)
+  {
+    const auto rand_vec3 = [](float min, float max) -> glm::vec3 {
+      return glm::vec3(common::rand_float(min, max),
+                       common::rand_float(min, max),
+                       common::rand_float(min, max));
+    };
+
+    const glm::vec3 origin = dim * 0.5f + rand_vec3(-1.0f, 1.0f) * radius;
+    const glm::vec3 target = rand_vec3(0.0f, 1.0f) * dim;
+
+    origins[i] =
+        io_component_voxel_shape->to_world_space(shape, io_cvt(origin));
+    directions[i] = io_cvt(glm::normalize(
+        glm::vec3(io_cvt(
+            io_component_voxel_shape->to_world_space(shape, io_cvt(target)))) -
+        glm::vec3(io_cvt(origins[i]))));
+  }
+
+  uint32_t result;
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = 0u;
+    for (uint32_t j = 0u; j < num_rays; ++j)
+      result += io_component_voxel_shape->raycast(shape, origins[j],
+                                                  directions[j], FLT_MAX,
+                                                  nullptr);
+    timer_sample_end();
+  }
+  timer_finalize("Raycast (API)", result);
+
+  voxel_raycaster.invalidate();
+  for (uint32_t i = 0u; i < num_samples; ++i)
+  {
+    timer_sample_start();
+    result = 0u;
+    for (uint32_t j = 0u; j < num_rays; ++j)
+      result += voxel_raycaster.raycast(shape, origins[j], directions[j],
+                                        FLT_MAX, nullptr);
+    timer_sample_end();
+  }
+  timer_finalize("Raycast (Plugin)", result);
+}
+
+} // namespace benchmark